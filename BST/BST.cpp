@@ -37,10 +37,11 @@ INT_64 LineRand()
     RRand = y1 & 0xFFFFFFFF00000000LL ^ (y2 & 0xFFFFFFFF00000000LL) >> 32;
     return RRand;
 }
+template <Balancing B>
 void test_rand(int n)
 {
     //создание дерева для 64 – разрядных ключей типа INT_64
-    BinaryTree< INT_64, int > tree;
+    BinaryTree< INT_64, int, B, NodePool, false, OperationCounters > tree;
     //массив для ключей, которые присутствуют в дереве
     INT_64* m = new INT_64[n];
     //установка первого случайного числа
@@ -67,12 +68,9 @@ void test_rand(int n)
             D += tree.getLastOpPassedNodesNum();
             tree.insert(m[rand() % n], 1);
             I += tree.getLastOpPassedNodesNum();
-            try {
-                tree.at(LineRand());
-                S += tree.getLastOpPassedNodesNum();
-            }
-            //обработка исключения при ошибке операции поиска
-            catch (...) { S += tree.getLastOpPassedNodesNum(); }
+            //промах поиска не бросает исключение
+            tree.try_get(LineRand());
+            S += tree.getLastOpPassedNodesNum();
          }
         else //90% успешных операций
         {
@@ -85,11 +83,8 @@ void test_rand(int n)
             if (result2 != true) std::cout << "WARNING!!!!222!!!";
             I += tree.getLastOpPassedNodesNum();
             m[ind] = key;
-            try {
-                tree.at(m[rand() % n]);
-                S += tree.getLastOpPassedNodesNum();
-            }
-            catch (...) { S += tree.getLastOpPassedNodesNum(); }
+            tree.try_get(m[rand() % n]);
+            S += tree.getLastOpPassedNodesNum();
         } //конец теста
        //вывод результатов:
        //вывод размера дерева после теста
@@ -106,10 +101,11 @@ void test_rand(int n)
     delete[] m;
 }
 //Тест трудоёмкости операций вырожденного BST - дерева
+template <Balancing B>
 void test_ord(int n)
 {
     //создание дерева для 64 – разрядных ключей типа INT_64
-    BinaryTree< INT_64, int > tree;
+    BinaryTree< INT_64, int, B, NodePool, false, OperationCounters > tree;
     //массив для ключей, которые присутствуют в дереве
     INT_64* m = new INT_64[n];
     //заполнение дерева и массива элементами
@@ -141,12 +137,9 @@ void test_ord(int n)
             I += tree.getLastOpPassedNodesNum();
             k = LineRand() % (10000 * n);
             k = k + !(k % 2); // случайный нечётный ключ
-            try {
-                tree.at(k);
-                S += tree.getLastOpPassedNodesNum();
-            }
-            //обработка исключения при ошибке операции поиска
-            catch (...) { S += tree.getLastOpPassedNodesNum(); }
+            //промах поиска не бросает исключение
+            tree.try_get(k);
+            S += tree.getLastOpPassedNodesNum();
        /* }
         else //90% успешных операций
         {
@@ -174,7 +167,10 @@ void test_ord(int n)
     // вывод размера дерева после теста
     std::cout << "items count:" << tree.size() << endl;
      //теоретической оценки трудоёмкости операций BST
-    std::cout << "n/2 =" << n / 2 << endl;
+    if constexpr (B == Balancing::None)
+        std::cout << "n/2 =" << n / 2 << endl;
+    else
+        std::cout << "log2(n)=" << log((double)n) / log(2.0) << endl;
     //экспериментальной оценки трудоёмкости вставки
     std::cout << "Count insert: " << I / (n / 2) << endl;
     //экспериментальной оценки трудоёмкости удаления
@@ -376,7 +372,7 @@ int main()
         }
     });
     MenuItem keys(" keys() [Получение списка ключей t -> L -> R ]", [&] {
-        auto list = bstree.keys();
+        auto list = bstree.keys(TraversalOrder::PreOrder);
         std::cout << "\n\nПолный список ключей: ";
         for (auto i : list) {
             std::cout << "[" << i << "] ";
@@ -402,9 +398,17 @@ int main()
         std::cout << " Введите размер коллекции: ";
         std::cin >> input;
         std::cout << "\n Случайное дерево:\n===========================\n";
-        test_rand(input);
+        test_rand<Balancing::None>(input);
         std::cout << "===========================\n Вырожденное дерево:\n===========================\n";
-        test_ord(input);
+        test_ord<Balancing::None>(input);
+        std::cout << "===========================\n Случайное дерево (AVL):\n===========================\n";
+        test_rand<Balancing::AVL>(input);
+        std::cout << "===========================\n Упорядоченные ключи (AVL):\n===========================\n";
+        test_ord<Balancing::AVL>(input);
+        std::cout << "===========================\n Случайное дерево (красно-чёрное):\n===========================\n";
+        test_rand<Balancing::RedBlack>(input);
+        std::cout << "===========================\n Упорядоченные ключи (красно-чёрное):\n===========================\n";
+        test_ord<Balancing::RedBlack>(input);
         std::cout << "===========================";
         _getch();
     });
@@ -1,11 +1,23 @@
 ﻿#pragma once
 #include <concepts>
+#include <compare>
 #include <string>
 #include <functional>
 #include <stack>
 #include <queue>
 #include <math.h>
 #include <list>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <stdexcept>
+#include <iostream>
+#include <thread>
+#include <exception>
+#include <system_error>
+#include "NodePool.h"
+#include "Instrumentation.h"
 
 template<typename T>
 concept Hashable = requires(T a) {
@@ -21,39 +33,182 @@ concept Comparable = requires(T a, T b) {
 template<typename T>
 concept CopyConstructible = std::is_copy_constructible<T>::value;
 
-size_t lastOperationPassedNodes = 0; //for insert, at, erase
+// Iterator over key:value pairs (anything with .first and .second: std::pair, map elements, tree elements)
+template<typename It, typename K, typename V>
+concept KeyValueIterator = std::input_iterator<It> && requires(It it) {
+	{ (*it).first } -> std::convertible_to<K>;
+	{ (*it).second } -> std::convertible_to<V>;
+};
+
+// Order of the elements exported by keys(), values() and items()
+enum class TraversalOrder {
+	Sorted,		// Ascending keys
+	PreOrder	// {root, left subtree, right subtree}: inserting the keys in this order rebuilds the same tree
+};
+
+// Balancing strategy applied by the modifying operations (insert, operator[], erase)
+enum class Balancing {
+	None,	// Plain BST: the shape depends on the keys order (sorted input degenerates into a list)
+	AVL,		// Heights of the sibling subtrees differ at most by one: O(log n) path on any input
+	RedBlack	// Red-black colouring: height <= 2*log2(n+1), at most 2 rotations per insert and 3 per erase
+};
+
+// Number of nodes in the subtree, kept by the nodes of the trees with order statistics
+template<bool Enabled>
+struct SubtreeSize {
+	size_t count = 1;
+};
+template<>
+struct SubtreeSize<false> {};
 
-template <Comparable K, CopyConstructible V>
+// Allocator is a template providing memory for the tree nodes (see NodePool.h)
+// OrderStatistics makes every node keep its subtree size: rank/select operations become O(log n)
+// Instrumentation counts the work done by the operations (see Instrumentation.h)
+template <Comparable K, CopyConstructible V, Balancing B = Balancing::None, template<typename> class Allocator = NodePool, bool OrderStatistics = false, class Instrumentation = NoInstrumentation>
 class BinaryTree
 {
 public:
+	class iterator_base;
 	class const_iterator;
 	class iterator;
 	class reverse_iterator;
 	class const_reverse_iterator;
+	template<typename Iterator, typename ReverseIterator>
+	class basic_range_view;
+	using range_view = basic_range_view<iterator, reverse_iterator>;
+	using const_range_view = basic_range_view<const_iterator, const_reverse_iterator>;
 private:
 
-	struct Node {
+	struct Node : SubtreeSize<OrderStatistics> {
 		K key;
 		V value;
+		// Balancing info shares one byte:
+		unsigned char height : 7 = 1; // AVL: height of the subtree (leaf is 1)
+		unsigned char red : 1 = 1; // RedBlack: colour of the node (new nodes are red)
 		Node* left = nullptr;
 		Node* right = nullptr;
+		Node* parent = nullptr;
 	};
 
 	Node* root = nullptr;
-	size_t size_ = 0;
-
-	void forEachInternal(std::function<void(K&, V&)>) const;
-	void forEachInternal(std::function<void(Node*)>);
-	void forEachHorizontalInternal(std::function<void(K&, V&, size_t depth, size_t ordinalNumber)>) const;
-
-	Node* findRecursive(const K& key, Node* node, std::stack<Node*>& wayFromRoot) const;
-	Node* findRecursive(const K& key, Node* node) const;
-	Node* eraseRecursive(Node* currentNode, const K& key, bool& success);
-	bool insertRecursive(const K& key, const V& value, Node* node);
-	Node* findAndCreateIfNotExists(const K& key, Node* node);
-	size_t _getNodeDepth(const K& key, Node* node, int steps) const;
+	// Number of nodes. Split leaves it unknown in the trees without order statistics (counting the nodes would cost O(n)):
+	// then the first size() call counts them, and size_ is meaningless until then
+	mutable size_t size_ = 0;
+	mutable bool sizeUnknown = false;
+	// The first and the last nodes in the keys order (nullptr in the empty tree): begin/rbegin and appends at the edges are O(1)
+	Node* minNode = nullptr;
+	Node* maxNode = nullptr;
+	Allocator<Node> allocator;
+	// Lookups are const, but they are counted too
+	[[no_unique_address]] mutable Instrumentation counters;
+
+	// The value is constructed in the node from valueArgs (value-initialized without them)
+	template<typename... ValueArgs>
+	Node* createNode(const K& key, ValueArgs&&... valueArgs);
+	void destroyNode(Node* node);
+	// Copies the nodes of other tree preserving its shape (the tree has to be empty)
+	void cloneFrom(const BinaryTree& other);
+
+	// Traversals pass the nodes to the visitor: visit(Node*) in order, visit(Node*, depth, ordinalNumber) horizontally.
+	// Visitors are template parameters, so they are inlined into the loops.
+	// In-order walk goes through the parent links: no extra memory on any tree shape
+	template<typename Visitor>
+	void forEachNode(Visitor&& visit) const;
+	template<typename Visitor>
+	void forEachNode(TraversalOrder order, Visitor&& visit) const;
+	template<typename Visitor>
+	void forEachHorizontalInternal(Visitor&& visit) const;
+
+	// Search methods are iterative: the depth of unbalanced tree is limited by its size only, not by the stack.
+	// findNode is the lookup core of find, contains, at, try_get and get_or
+	Node* findNode(const K& key) const;
+	long findDepth(const K& key) const;
+	// Goes down from the node to the key. Returns the node with the key or nullptr,
+	// parent and toRight describe the place where the key would be linked (they are kept if the node is nullptr)
+	Node* descend(Node* node, const K& key, Node*& parent, bool& toRight) const;
+	// Finger search: climbs from the start node only as high as the key requires, then descends
+	Node* fingerSearch(Node* start, const K& key, Node*& parent, bool& toRight) const;
+	// Bounds search cores. Return the first node with the key after (strict) or not before the provided one,
+	// and the last node with the key before (strict) or not after the provided one. nullptr if there is no such node
+	Node* lowerBoundNode(const K& key, bool strict) const;
+	Node* floorNode(const K& key, bool strict) const;
+	// Returns the found or created node
+	Node* insertNode(const K& key, const V& value, bool& inserted);
+	// Creates the node at the place found by descend and restores the balance. The value is made as by createNode
+	template<typename... ValueArgs>
+	Node* attachNode(Node* parent, bool toRight, const K& key, ValueArgs&&... valueArgs);
+	// Moves the cached first/last node to its neighbour if the node is going to be removed
+	void forgetExtremes(Node* node);
+	// Unbalanced and AVL erase. Returns whether the key was found
+	bool eraseNode(const K& key);
+	// Restores the subtree info and balance going up from the node to the top of its (sub)tree.
+	// top is the root of the tree or of the detached subtree: it's updated if the rotations replace it
+	void retrace(Node* node, Node*& top);
 	void verticalPrint(Node* currentNode, int level);
+
+	static unsigned char heightOf(Node* node);
+	static void updateHeight(Node* node);
+	static size_t sizeOf(Node* node);
+	// Recalculates the info node keeps about its subtree (AVL height, subtree size) from its children
+	static void updateSubtreeInfo(Node* node);
+	// Child links setters keeping the parent links consistent
+	static void setLeft(Node* node, Node* child);
+	static void setRight(Node* node, Node* child);
+	Node* rotateLeft(Node* node);
+	Node* rotateRight(Node* node);
+	// Restores the balance of the subtree after its child subtree has changed. No-op for Balancing::None
+	Node* rebalance(Node* node);
+
+	// Red-black tree keeps the way from root in a fixed array: its height never exceeds 2*log2(n+1)
+	static constexpr size_t MAX_RED_BLACK_HEIGHT = 2 * 8 * sizeof(size_t) + 2;
+	static bool isRed(Node* node);
+	void replaceChild(Node* parent, Node* oldChild, Node* newChild);
+	static void replaceChild(Node*& top, Node* parent, Node* oldChild, Node* newChild);
+	void fixRedBlackInsert(Node* node, Node*& top);
+	bool eraseRedBlack(const K& key);
+
+	// Split and join of the detached subtrees (their roots have no parent). Balance is kept by every balancing strategy:
+	// join costs O(|height difference|), split costs O(height) in total
+	// Joins the trees with all the keys of left < middle->key < all the keys of right using middle as the link
+	Node* joinSubtrees(Node* left, Node* middle, Node* right);
+	// Splits the tree into the keys less than the key, the node with the key (nullptr if there is no such node) and the greater keys
+	void splitSubtree(Node* tree, const K& key, Node*& less, Node*& equal, Node*& greater);
+	static size_t blackHeightOf(Node* node);
+	// Post-order walk through the parent links: every leaf is unlinked and passed to release, then its parent becomes a leaf.
+	// No comparisons, no rebalancing and no extra memory
+	template<typename Release>
+	static void releaseSubtree(Node* node, Release&& release);
+	// Removes the nodes [first, stop) (stop is nullptr for the range up to the end) with two splits and one join. Returns their number
+	size_t eraseNodes(Node* first, Node* stop);
+	// Makes the detached subtree of the source tree the content of this empty tree. The allocators share memory, no node is copied
+	void adoptSubtree(BinaryTree& source, Node* top);
+
+	// Builds the content of the empty tree in O(n): produce(append) has to call append(key, value) for the unique keys in the ascending order,
+	// append returns the created node. Nodes are allocated in the keys order and linked into the perfectly balanced tree
+	template<typename Producer>
+	void buildSorted(Producer&& produce);
+
+	enum class SetOperation { Union, Intersection, Difference };
+	// Merges the sorted sequences [one, oneStop) and [other, otherStop) of two trees (nullptr stop is the end) into this empty tree
+	void buildSetOperation(SetOperation operation, Node* one, Node* oneStop, Node* other, Node* otherStop);
+	// Splits the key space into threads ranges merged in parallel, the results are joined
+	static BinaryTree parallelSetOperation(SetOperation operation, const BinaryTree& one, const BinaryTree& other, unsigned threads);
+
+	// Links count nodes of the chain (linked through the right links) into the balanced subtree and moves head behind them.
+	// Red-black colouring: nodes on the redDepth level are red, the other ones are black
+	Node* linkBalanced(Node*& head, size_t count, size_t depth, size_t redDepth);
+
+	// In-order neighbours found by the parent links. nullptr if there is no such node
+	static Node* leftmost(Node* node);
+	static Node* rightmost(Node* node);
+	static Node* successor(Node* node);
+	static Node* predecessor(Node* node);
+	// Next node in {root, left subtree, right subtree} order found by the parent links
+	static Node* preorderNext(Node* node);
+
+	// Order statistics supporting methods
+	Node* selectNode(size_t index) const;
+	size_t countLess(const K& key) const;
 	
 public:
 	/*==========================================
@@ -67,6 +222,60 @@ public:
 	BinaryTree& operator=(BinaryTree&& other);
 	~BinaryTree();
 
+	// Builds the tree from key:value pairs in any order. Sorts a copy of them: O(n log n)
+	template<KeyValueIterator<K, V> InputIt>
+	BinaryTree(InputIt first, InputIt last);
+
+	/*==========================================
+	             BULK CONSTRUCTION
+	==========================================*/
+
+	// Builds perfectly balanced tree from key:value pairs sorted by key in O(n).
+	// Nodes are allocated in one pass in the keys order. Repeated keys are skipped (the first pair wins),
+	// throws invalid_argument if keys are not sorted
+	template<KeyValueIterator<K, V> InputIt>
+	static BinaryTree from_sorted(InputIt first, InputIt last);
+	// Replaces the tree content with the sorted key:value pairs in O(n) (see from_sorted)
+	template<KeyValueIterator<K, V> InputIt>
+	void assign_sorted(InputIt first, InputIt last);
+	// Replaces the tree content with the key:value pairs in any order. Sorts a copy of them: O(n log n)
+	template<KeyValueIterator<K, V> InputIt>
+	void assign(InputIt first, InputIt last);
+
+	/*==========================================
+	               SPLIT AND JOIN
+	==========================================*/
+
+	// Moves the elements to two new trees: the keys less than the provided one and the other keys. The tree becomes empty.
+	// Nodes are relinked, not copied: O(log n) for the balanced trees, O(height) for the unbalanced one.
+	// The parts share the memory of the allocator (see NodePool::share), so they can be used by different threads.
+	// Each part keeps all the memory of the original tree alive (the nodes of the other part too) until both parts are gone.
+	// Without OrderStatistics the sizes of the parts are counted by their first size() call
+	std::pair<BinaryTree, BinaryTree> split(const K& key) requires Shareable<Allocator<Node>>;
+	// Moves the elements of both trees to the new one. Every key of left has to be less than every key of right
+	// (throws invalid_argument otherwise). Nodes are relinked, not copied: O(log n), O(height) for the unbalanced trees
+	static BinaryTree join(BinaryTree&& left, BinaryTree&& right) requires Shareable<Allocator<Node>>;
+
+	/*==========================================
+	               SET OPERATIONS
+	==========================================*/
+
+	// Build the new perfectly balanced tree in O(m + n) merging the sorted sequences of the trees.
+	// Elements present in both trees take the value from the first one
+	// Returns the tree with the keys of any of the trees
+	static BinaryTree merge_union(const BinaryTree& one, const BinaryTree& other);
+	// Returns the tree with the keys present in both trees
+	static BinaryTree intersect(const BinaryTree& one, const BinaryTree& other);
+	// Returns the tree with the keys of the first tree absent in the other one
+	static BinaryTree difference(const BinaryTree& one, const BinaryTree& other);
+	// Parallel versions. The key space is divided into threads ranges by the keys of the upper levels of the bigger tree,
+	// every range is merged by its own thread into its own tree and the parts are joined (see join):
+	// O((m + n) / threads + threads * log(m + n)). The ranges are even for the balanced trees.
+	// The trees must not be changed while the operation goes
+	static BinaryTree merge_union(const BinaryTree& one, const BinaryTree& other, unsigned threads) requires Shareable<Allocator<Node>>;
+	static BinaryTree intersect(const BinaryTree& one, const BinaryTree& other, unsigned threads) requires Shareable<Allocator<Node>>;
+	static BinaryTree difference(const BinaryTree& one, const BinaryTree& other, unsigned threads) requires Shareable<Allocator<Node>>;
+
 	/*==========================================
 	                INFORMATIONAL
 	==========================================*/
@@ -80,12 +289,34 @@ public:
 	// Shows if tree is empty
 	bool empty() const;
 
-	// Returns the list of tree keys in order: {root, less elements, greater elements}
-	std::list<K> keys() const;
+	// Export of the tree content. The vector versions make one allocation of size() elements,
+	// the output iterator versions write the elements and return the iterator behind the last written one
+	std::vector<K> keys(TraversalOrder order = TraversalOrder::Sorted) const;
+	std::vector<V> values(TraversalOrder order = TraversalOrder::Sorted) const;
+	std::vector<std::pair<K, V>> items(TraversalOrder order = TraversalOrder::Sorted) const;
+	template<std::output_iterator<const K&> Out>
+	Out keys(Out out, TraversalOrder order = TraversalOrder::Sorted) const;
+	template<std::output_iterator<const V&> Out>
+	Out values(Out out, TraversalOrder order = TraversalOrder::Sorted) const;
+	template<std::output_iterator<std::pair<K, V>> Out>
+	Out items(Out out, TraversalOrder order = TraversalOrder::Sorted) const;
 
 	long getNodeDepth(K key) const;
+	// Returns the position of the key in the sorted keys sequence or -1 if tree doesn't contain the key.
+	// O(log n) with OrderStatistics, O(n) otherwise
 	long getNodeIndex(K key) const;
 
+	/*==========================================
+	      ORDER STATISTICS (OrderStatistics)
+	==========================================*/
+
+	// Returns the iterator pointing at the element with the provided position in sorted sequence (end if index >= size)
+	iterator nth(size_t index) requires OrderStatistics;
+	// Returns the const iterator pointing at the element with the provided position in sorted sequence (cend if index >= size)
+	const_iterator nth(size_t index) const requires OrderStatistics;
+	// Returns the number of keys in [lo, hi)
+	size_t count_range(const K& lo, const K& hi) const requires OrderStatistics;
+
 	/*==========================================
 					  ACCESS
 	==========================================*/
@@ -94,6 +325,31 @@ public:
 	iterator find(const K& key);
 	// Returns the iterator pointing at the leaf contains the provided key
 	const_iterator find(const K& key) const;
+	// Finger search: the key is searched from the hint element (see hinted insert, end/rend hint starts from the last element).
+	// Returns end if tree doesn't contain the key
+	iterator find_from(const iterator_base& hint, const K& key);
+	const_iterator find_from(const iterator_base& hint, const K& key) const;
+
+	// Bounds search in O(log n). Every method returns end if there is no such element
+	// Returns the iterator pointing at the first element with the key not less than the provided one
+	iterator lower_bound(const K& key);
+	const_iterator lower_bound(const K& key) const;
+	// Returns the iterator pointing at the first element with the key greater than the provided one
+	iterator upper_bound(const K& key);
+	const_iterator upper_bound(const K& key) const;
+	// Returns {lower_bound, upper_bound}: the range with the element with the provided key or the empty range at its place
+	std::pair<iterator, iterator> equal_range(const K& key);
+	std::pair<const_iterator, const_iterator> equal_range(const K& key) const;
+	// Returns the iterator pointing at the element with the greatest key not greater than the provided one
+	iterator floor(const K& key);
+	const_iterator floor(const K& key) const;
+	// Returns the iterator pointing at the element with the least key not less than the provided one (same as lower_bound)
+	iterator ceiling(const K& key);
+	const_iterator ceiling(const K& key) const;
+	// Returns the view of the elements with the keys in [lo, hi) (empty if hi <= lo). The view is iterable forward and backward:
+	// the bounds are found in O(log n), so passing k elements costs O(log n + k) instead of the full traversal
+	range_view range(const K& lo, const K& hi);
+	const_range_view range(const K& lo, const K& hi) const;
 
 	// Returns the iterator pointing at the element behind the last one
 	iterator end();
@@ -125,6 +381,12 @@ public:
 	// Access by key operator. Throws out_of_range exception if tree doesn't contain the provided key
 	const V& at(const K&) const;
 
+	// Non-throwing access: returns the pointer to the value or nullptr if tree doesn't contain the provided key
+	V* try_get(const K&);
+	const V* try_get(const K&) const;
+	// Returns the copy of the value or defaultValue if tree doesn't contain the provided key
+	V get_or(const K&, const V& defaultValue) const;
+
 	/*==========================================
 					  MODYFING
 	==========================================*/
@@ -132,9 +394,19 @@ public:
 	// Inserts the new key:value pair in the tree
 	bool insert(const K&, const V&);
 	bool insert(std::pair<const K&, const V&> pair);
+	// Hinted insert: the place is searched from the hint element (any iterator of the tree) climbing only as high as the key requires,
+	// so the keys inserted next to the hint cost O(1) amortized comparisons instead of O(log n).
+	// End/rend hint means the search from the last element: appending the keys in ascending order costs O(1).
+	// Returns the iterator pointing at the element with the key (the existing one if the key was in the tree)
+	iterator insert(const iterator_base& hint, const K& key, const V& value);
 	
 	// Removes the leaf with the corresponding key
 	bool erase(const K&);
+	// Removes the elements [first, last) of the tree in O(log n + k): the range is cut out by two splits and one join,
+	// its nodes are released in one pass without rebalancing. Returns the iterator pointing at the element behind the removed ones
+	iterator erase(const_iterator first, const_iterator last);
+	// Removes the elements with the keys in [lo, hi) in O(log n + k) (see erase of the iterators range). Returns the number of removed elements
+	size_t erase_range(const K& lo, const K& hi);
 	
 	// Clears the tree
 	void clear();
@@ -144,36 +416,40 @@ public:
 				PATH THROUGH METHODS
 	==========================================*/
 
-	// In order iterative pass algorithm. Transfers every tree value into lambda argument
-	void forEach(std::function<void(const K&, V&)>);
-	void forEach(std::function<void(const K&, const V&)>) const;
+	// In order iterative pass algorithm. Transfers every tree value into lambda argument.
+	// Any callable is accepted (lambda, functor, std::function): it's called directly, without type erasure
+	template<std::invocable<const K&, V&> Func>
+	void forEach(Func&& func);
+	template<std::invocable<const K&, const V&> Func>
+	void forEach(Func&& func) const;
 
 	// Horizontal iterative path through algorithm. Can be used to represent tree as a table
 	// Third argument is depth (>=0): displays how deep you should go to reach the leaf (row)
 	// Fourth argument is ordinalNumber (>=0): displays the position in leafs horizontal sequence (coloumn)
 	//  *(sequence gaps are possible if tree isn't completed)
-	void forEachHorizontal(std::function<void(const K&, const V&)>) const;
-	void forEachHorizontal(std::function<void(const K&, const V&, size_t depth)>) const;
-	void forEachHorizontal(std::function<void(const K&, const V&, size_t depth, size_t ordinalNumber)>) const;
+	// The callable takes (key, value), (key, value, depth) or (key, value, depth, ordinalNumber)
+	template<typename Func>
+		requires std::invocable<Func&, const K&, const V&> || std::invocable<Func&, const K&, const V&, size_t> || std::invocable<Func&, const K&, const V&, size_t, size_t>
+	void forEachHorizontal(Func&& func) const;
 
 
 	/*==========================================
 					ITERATORS
 	==========================================*/
 
-	// Abstract iterator interface. Highest level superclass
+	// Iterator interface. Highest level superclass
+	// Iterator is just a node pointer and a tree pointer: steps use the parent links of the nodes,
+	// so iterators never allocate and each step costs O(1) amortized.
+	// End/rend iterators keep nullptr as the node
 	class iterator_base {
 	protected:
 		friend class BinaryTree;
-		BinaryTree<K, V>::Node* ptr = nullptr;
-		const BinaryTree<K, V>* associatedTree = nullptr;
-		std::stack<Node*> nodes;
-		iterator_base(Node*);
+		BinaryTree::Node* ptr = nullptr;
+		const BinaryTree* associatedTree = nullptr;
+		iterator_base(Node* node, const BinaryTree* tree) : ptr(node), associatedTree(tree) {};
 		iterator_base() {};
 		std::pair<const K&, V&> get() const;
-		// to override:
-		virtual void goForward() = 0;
-		virtual void goBackward() = 0;
+		// Heirs provide goForward() and goBackward()
 	public:
 		friend bool operator==(const iterator_base& one, const iterator_base& two) {
 			if (one.associatedTree != two.associatedTree) return false;
@@ -186,12 +462,12 @@ public:
 	// Provides internal heirs functional and comparing operations
 	class forward_iterator_base : public iterator_base {
 	protected:
-		forward_iterator_base(Node* node) : iterator_base(node) {};
-		void goForward() override;
-		void goBackward() override;
+		forward_iterator_base(Node* node, const BinaryTree* tree) : iterator_base(node, tree) {};
+		void goForward();
+		void goBackward();
 	public:
 		forward_iterator_base() {};
-		friend std::strong_ordering operator<=>(const BinaryTree<K, V>::forward_iterator_base& one, const BinaryTree<K, V>::forward_iterator_base& two) {
+		friend std::strong_ordering operator<=>(const BinaryTree::forward_iterator_base& one, const BinaryTree::forward_iterator_base& two) {
 			if (one.ptr == nullptr) {
 				if (two.ptr == nullptr)
 					return std::strong_ordering::equal;
@@ -207,12 +483,12 @@ public:
 	// Provides internal heirs functional and comparing operations
 	class reverse_iterator_base : public iterator_base {
 	protected:
-		reverse_iterator_base(Node* node) : iterator_base(node) {};
-		void goForward() override;
-		void goBackward() override;
+		reverse_iterator_base(Node* node, const BinaryTree* tree) : iterator_base(node, tree) {};
+		void goForward();
+		void goBackward();
 	public:
 		reverse_iterator_base() {};
-		friend std::strong_ordering operator<=>(const BinaryTree<K, V>::reverse_iterator_base& one, const BinaryTree<K, V>::reverse_iterator_base& two) {
+		friend std::strong_ordering operator<=>(const BinaryTree::reverse_iterator_base& one, const BinaryTree::reverse_iterator_base& two) {
 			if (one.ptr == nullptr) {
 				if (two.ptr == nullptr)
 					return std::strong_ordering::equal;
@@ -231,7 +507,7 @@ public:
 	class const_iterator : public forward_iterator_base {
 	private:
 		friend class BinaryTree;
-		const_iterator(Node* node) : forward_iterator_base(node) {};
+		const_iterator(Node* node, const BinaryTree* tree) : forward_iterator_base(node, tree) {};
 	public:
 		const_iterator() = default;
 		const_iterator(const iterator& other) { this->copy((iterator_base&)other); };
@@ -247,7 +523,7 @@ public:
 	class iterator : public forward_iterator_base {
 	private:
 		friend class BinaryTree;
-		iterator(Node* node) : forward_iterator_base(node) {};
+		iterator(Node* node, const BinaryTree* tree) : forward_iterator_base(node, tree) {};
 	public:
 		iterator() = default;
 		iterator(const iterator& other) = default;
@@ -262,7 +538,7 @@ public:
 	class const_reverse_iterator : public reverse_iterator_base {
 	private:
 		friend class BinaryTree;
-		const_reverse_iterator(Node* node) : reverse_iterator_base(node) {};
+		const_reverse_iterator(Node* node, const BinaryTree* tree) : reverse_iterator_base(node, tree) {};
 	public:
 		const_reverse_iterator() = default;
 		const_reverse_iterator(const const_reverse_iterator& other) = default;
@@ -278,7 +554,7 @@ public:
 	class reverse_iterator : public reverse_iterator_base {
 	private:
 		friend class BinaryTree;
-		reverse_iterator(Node* node) : reverse_iterator_base(node) {};
+		reverse_iterator(Node* node, const BinaryTree* tree) : reverse_iterator_base(node, tree) {};
 	public:
 		reverse_iterator() = default;
 		reverse_iterator(const reverse_iterator& other) = default;
@@ -289,10 +565,29 @@ public:
 		reverse_iterator operator--(int) { reverse_iterator newVal = *this; this->goBackward(); return newVal; };
 	};
 
+	// View of the elements in the keys range: pair of forward iterators and pair of reverse iterators bounding it.
+	// The view doesn't own anything: it's valid while its elements and the elements bounding it stay in the tree
+	template<typename Iterator, typename ReverseIterator>
+	class basic_range_view {
+	private:
+		friend class BinaryTree;
+		Iterator first, last;
+		ReverseIterator rfirst, rlast;
+		basic_range_view(Node* begin, Node* end, Node* rbegin, Node* rend, const BinaryTree* tree)
+			: first(begin, tree), last(end, tree), rfirst(rbegin, tree), rlast(rend, tree) {};
+	public:
+		Iterator begin() const { return first; };
+		Iterator end() const { return last; };
+		ReverseIterator rbegin() const { return rfirst; };
+		ReverseIterator rend() const { return rlast; };
+		bool empty() const { return first == last; };
+	};
+
 	/*==========================================
 					SERVICE
 	==========================================*/
-	size_t getLastOpPassedNodesNum() { return lastOperationPassedNodes; }
+	size_t getLastOpPassedNodesNum() const requires Instrumentation::enabled { return counters.lastOperation().passedNodes; }
+	const Instrumentation& getInstrumentation() const { return counters; }
 	void print();
 	void verticalPrint();
 };
@@ -311,201 +606,895 @@ public:
 
 /*==========================================================================================
 
-								  SUPPORTING RECURSIVE METHODS
+								  SUPPORTING SEARCH METHODS
 
 ===========================================================================================*/
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::Node* BinaryTree<K, V>::findRecursive(const K& key, Node* node, std::stack<Node*>& wayFromRoot) const
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::findNode(const K& key) const
 {
-	if (node == root) lastOperationPassedNodes = 0;
-	lastOperationPassedNodes++;
+	counters.begin(Operation::Find);
+	Node* node = root;
+	while (true) {
+		counters.passNode();
+		if (node == nullptr)
+			return nullptr;
+		counters.compare();
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0)
+			return node;
+		node = order > 0 ? node->right : node->left;
+	}
+}
 
-	if (node == nullptr) 
-		return nullptr;
-	if (node->key == key)
-		return node;
-	if (key > node->key) {
-		wayFromRoot.push(node);
-		return findRecursive(key, node->right, wayFromRoot);
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::lowerBoundNode(const K& key, bool strict) const
+{
+	// The last node passed on the way to the left is the nearest one after the key
+	Node* bound = nullptr;
+	Node* node = root;
+	while (node != nullptr) {
+		counters.passNode();
+		counters.compare();
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0 && !strict)
+			return node;
+		if (order < 0) {
+			bound = node;
+			node = node->left;
+		}
+		else {
+			node = node->right;
+		}
 	}
-	else {
-		wayFromRoot.push(node);
-		return findRecursive(key, node->left,wayFromRoot);
+	return bound;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::floorNode(const K& key, bool strict) const
+{
+	// Mirrored lowerBoundNode
+	Node* bound = nullptr;
+	Node* node = root;
+	while (node != nullptr) {
+		counters.passNode();
+		counters.compare();
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0 && !strict)
+			return node;
+		if (order > 0) {
+			bound = node;
+			node = node->right;
+		}
+		else {
+			node = node->left;
+		}
 	}
+	return bound;
 }
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::Node* BinaryTree<K, V>::findRecursive(const K& key, Node* node) const
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline long BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::findDepth(const K& key) const
 {
-	if (node == root) lastOperationPassedNodes = 0;
-	lastOperationPassedNodes++;
+	long depth = 0;
+	for (Node* node = root; node != nullptr; depth++) {
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0)
+			return depth;
+		node = order > 0 ? node->right : node->left;
+	}
+	return -1;
+}
 
-	if (node == nullptr)
-		return nullptr;
-	if (node->key == key)
-		return node;
-	if (key > node->key) {
-		return findRecursive(key, node->right);
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::retrace(Node* node, Node*& top)
+{
+	while (node != nullptr) {
+		Node* parent = node->parent;
+		unsigned char heightBefore = node->height;
+		Node* subtreeRoot = rebalance(node);
+		if (subtreeRoot != node) {
+			replaceChild(top, parent, node, subtreeRoot);
+		}
+		else if constexpr (!OrderStatistics) {
+			// Nothing above depends on the subtree if its height hasn't changed
+			// (unbalanced tree keeps no info at all: the loop stops at once)
+			if (node->height == heightBefore) return;
+		}
+		node = parent;
 	}
-	else {
-		return findRecursive(key, node->left);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::descend(Node* node, const K& key, Node*& parent, bool& toRight) const
+{
+	while (node != nullptr) {
+		counters.passNode();
+		counters.compare();
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0)
+			return node;
+		toRight = order > 0;
+		parent = node;
+		node = toRight ? node->right : node->left;
 	}
+	return nullptr;
 }
 
-template<Comparable K, CopyConstructible V>
-inline size_t BinaryTree<K, V>::_getNodeDepth(const K& key, Node* node, int steps) const {
-	steps++;
-	if (node == nullptr)
-		return -1;
-	if (node->key == key)
-		return steps;
-	if (key > node->key) {
-		return _getNodeDepth(key, node->right, steps);
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::fingerSearch(Node* start, const K& key, Node*& parent, bool& toRight) const
+{
+	Node* node = start;
+	counters.passNode();
+	counters.compare();
+	std::strong_ordering order = key <=> node->key;
+	while (true) {
+		if (order == 0)
+			return node;
+		// The subtree on the key side of the node is bounded by the nearest ancestor on that side:
+		// the key belongs to the subtree if there is no such ancestor or the key is before it.
+		// The ancestors on the other side are passed without comparisons
+		// The last (first) node has no bounds on the right (left) side: no climbing at all
+		Node* bound = node;
+		if (order > 0) {
+			if (node == maxNode) bound = root;
+			while (bound->parent != nullptr && bound == bound->parent->right) {
+				counters.passNode();
+				bound = bound->parent;
+			}
+		}
+		else {
+			if (node == minNode) bound = root;
+			while (bound->parent != nullptr && bound == bound->parent->left) {
+				counters.passNode();
+				bound = bound->parent;
+			}
+		}
+		bound = bound->parent;
+		if (bound != nullptr) {
+			counters.passNode();
+			counters.compare();
+			std::strong_ordering boundOrder = key <=> bound->key;
+			if (boundOrder == 0 || boundOrder == order) {
+				// The key is at the bound or behind it: the search continues from there
+				node = bound;
+				order = boundOrder;
+				continue;
+			}
+		}
+		toRight = order > 0;
+		parent = node;
+		return descend(toRight ? node->right : node->left, key, parent, toRight);
+	}
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::insertNode(const K& key, const V& value, bool& inserted)
+{
+	Node* parent = nullptr;
+	bool toRight = false;
+	Node* node = descend(root, key, parent, toRight);
+	inserted = node == nullptr;
+	return inserted ? attachNode(parent, toRight, key, value) : node;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<typename... ValueArgs>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::attachNode(Node* parent, bool toRight, const K& key, ValueArgs&&... valueArgs)
+{
+	Node* newNode = createNode(key, std::forward<ValueArgs>(valueArgs)...);
+	if (parent == nullptr) {
+		root = minNode = maxNode = newNode;
+	}
+	else if (toRight) {
+		setRight(parent, newNode);
+		if (parent == maxNode) maxNode = newNode;
+	}
+	else {
+		setLeft(parent, newNode);
+		if (parent == minNode) minNode = newNode;
+	}
+	if constexpr (B == Balancing::RedBlack) {
+		if constexpr (OrderStatistics) {
+			for (Node* node = parent; node != nullptr; node = node->parent)
+				node->count++;
+		}
+		fixRedBlackInsert(newNode, root);
 	}
 	else {
-		return _getNodeDepth(key, node->left, steps);
+		retrace(parent, root);
 	}
+	return newNode;
 }
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forgetExtremes(Node* node)
+{
+	// The first node has no left child, so its successor is found in O(1) amortized (the last node is mirrored).
+	// Nodes with two children are never the extremes, and the relinking done by erase keeps the other nodes in place
+	if (node == minNode) minNode = successor(node);
+	if (node == maxNode) maxNode = predecessor(node);
+}
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline bool BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::eraseNode(const K& key)
+{
+	Node* target = root;
+	while (true) {
+		counters.passNode();
+		if (target == nullptr)
+			return false;
+		counters.compare();
+		std::strong_ordering order = key <=> target->key;
+		if (order == 0)
+			break;
+		target = order > 0 ? target->right : target->left;
+	}
+
+	forgetExtremes(target);
+	// The lowest node whose subtree has changed: balance is restored from it up to the root
+	Node* changed;
+	if (target->left == nullptr || target->right == nullptr) {
+		// Node with only one child or no child: the child takes its place
+		changed = target->parent;
+		replaceChild(target->parent, target, target->left != nullptr ? target->left : target->right);
+	}
+	else {
+		// Node with two children: the inorder successor (smallest in the right subtree)
+		// is unlinked and takes the place of the deleted node. Nodes are relinked, not copied,
+		// so the iterators pointing at the successor stay valid
+		Node* succ = target->right;
+		counters.passNode();
+		while (succ->left != nullptr) {
+			counters.passNode();
+			succ = succ->left;
+		}
+		if (succ != target->right) {
+			changed = succ->parent;
+			setLeft(succ->parent, succ->right);
+			setRight(succ, target->right);
+		}
+		else {
+			changed = succ;
+		}
+		setLeft(succ, target->left);
+		// Successor inherits the height of the target place: retrace compares the new heights with it
+		succ->height = target->height;
+		replaceChild(target->parent, target, succ);
+	}
+	destroyNode(target);
+	retrace(changed, root);
+	return true;
+}
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::Node* BinaryTree<K, V>::eraseRecursive(Node* currentNode, const K& key, bool& success) {
+/*==========================================================================================
 
-	if (currentNode == this->root) {
-		lastOperationPassedNodes = 0;
-	}
-	lastOperationPassedNodes++;
+								  NODES MEMORY
 
-	// Base case
-	if (currentNode == NULL) {
-		success = false;
-		return currentNode;
-	}
+===========================================================================================*/
 
-	// If the key to be deleted is smaller than the root's key,
-	// then it lies in the left subtree
-	if (key < currentNode->key) {
-		currentNode->left = eraseRecursive(currentNode->left, key, success);
-		return currentNode;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<typename... ValueArgs>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::createNode(const K& key, ValueArgs&&... valueArgs)
+{
+	Node* memory = allocator.allocate();
+	counters.allocate();
+	try {
+		return new (memory) Node{ {}, key, V(std::forward<ValueArgs>(valueArgs)...) };
 	}
-	// If the key to be deleted is greater than the root's key,
-	// then it lies in the right subtree
-	else if (key > currentNode->key) {
-		currentNode->right = eraseRecursive(currentNode->right, key, success);
-		return currentNode;
+	catch (...) {
+		allocator.deallocate(memory);
+		throw;
 	}
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::destroyNode(Node* node)
+{
+	node->~Node();
+	allocator.deallocate(node);
+	counters.deallocate();
+}
 
-	success = true;
-	// If key is same as root's key, then this is the node to be deleted
-	// Node with only one child or no child
-	if (currentNode->left == NULL) {
-		Node* temp = currentNode->right;
-		delete currentNode;
-		return temp;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::cloneFrom(const BinaryTree& other)
+{
+	counters.begin(Operation::Bulk);
+	if (other.root == nullptr) return;
+	if constexpr (Reservable<Allocator<Node>>)
+		allocator.reserve(other.size());
+
+	// Pre-order pass through both trees at once using the parent links: every source node is copied
+	// together with its balancing info and linked to the same position. No comparisons and no extra memory
+	auto copyNode = [&](Node* source, Node* parent) {
+		Node* copy = createNode(source->key, source->value);
+		copy->height = source->height;
+		copy->red = source->red;
+		if constexpr (OrderStatistics)
+			copy->count = source->count;
+		copy->parent = parent;
+		return copy;
+	};
+	try {
+		Node* source = other.root;
+		Node* copy = root = copyNode(source, nullptr);
+		while (source != nullptr) {
+			if (source->left != nullptr && copy->left == nullptr) {
+				copy->left = copyNode(source->left, copy);
+				source = source->left;
+				copy = copy->left;
+			}
+			else if (source->right != nullptr && copy->right == nullptr) {
+				copy->right = copyNode(source->right, copy);
+				source = source->right;
+				copy = copy->right;
+			}
+			else {
+				source = source->parent;
+				copy = copy->parent;
+			}
+		}
 	}
-	else if (currentNode->right == NULL) {
-		Node* temp = currentNode->left;
-		delete currentNode;
-		return temp;
+	catch (...) {
+		// Already copied nodes are linked: the tree is valid and can be cleared
+		clear();
+		throw;
 	}
+	size_ = other.size();
+	minNode = leftmost(root);
+	maxNode = rightmost(root);
+}
 
-	// Node with two children: Get the inorder successor (smallest
-	// in the right subtree)
-	Node* succParent = currentNode;
-	Node* succ = currentNode->right;
-	while (succ->left != NULL) {
-		lastOperationPassedNodes++;
-		succParent = succ;
-		succ = succ->left;
-	}
+/*==========================================================================================
+
+								  BALANCING
+
+===========================================================================================*/
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline unsigned char BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::heightOf(Node* node)
+{
+	return node == nullptr ? 0 : node->height;
+}
 
-	// Copy the inorder successor's content to this node
-	currentNode->key = succ->key;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::updateHeight(Node* node)
+{
+	unsigned char leftHeight = heightOf(node->left);
+	unsigned char rightHeight = heightOf(node->right);
+	node->height = (leftHeight > rightHeight ? leftHeight : rightHeight) + 1;
+}
 
-	// Delete the inorder successor
-	if (succParent->left == succ)
-		succParent->left = succ->right;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline size_t BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::sizeOf(Node* node)
+{
+	if constexpr (OrderStatistics)
+		return node == nullptr ? 0 : node->count;
 	else
-		succParent->right = succ->right;
+		return 0;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::updateSubtreeInfo(Node* node)
+{
+	if constexpr (B == Balancing::AVL)
+		updateHeight(node);
+	if constexpr (OrderStatistics)
+		node->count = sizeOf(node->left) + sizeOf(node->right) + 1;
+}
 
-	delete succ;
-	return currentNode;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::setLeft(Node* node, Node* child)
+{
+	node->left = child;
+	if (child != nullptr) child->parent = node;
 }
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::setRight(Node* node, Node* child)
+{
+	node->right = child;
+	if (child != nullptr) child->parent = node;
+}
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::rotateLeft(Node* node)
+{
+	// The right child becomes the root of the subtree, its left subtree is passed to the old root:
+	// (a node (b pivot c)) -> ((a node b) pivot c)
+	counters.rotate();
+	Node* pivot = node->right;
+	setRight(node, pivot->left);
+	pivot->parent = node->parent;
+	setLeft(pivot, node);
+	updateSubtreeInfo(node);
+	updateSubtreeInfo(pivot);
+	return pivot;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::rotateRight(Node* node)
+{
+	// Mirrored rotateLeft
+	counters.rotate();
+	Node* pivot = node->left;
+	setLeft(node, pivot->right);
+	pivot->parent = node->parent;
+	setRight(pivot, node);
+	updateSubtreeInfo(node);
+	updateSubtreeInfo(pivot);
+	return pivot;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::rebalance(Node* node)
+{
+	updateSubtreeInfo(node);
+	if constexpr (B == Balancing::AVL) {
+		int balanceFactor = heightOf(node->right) - heightOf(node->left);
+		// Right subtree is too high
+		if (balanceFactor > 1) {
+			// Right-left case: straighten the right subtree first
+			if (heightOf(node->right->left) > heightOf(node->right->right))
+				node->right = rotateRight(node->right);
+			return rotateLeft(node);
+		}
+		// Left subtree is too high
+		if (balanceFactor < -1) {
+			// Left-right case: straighten the left subtree first
+			if (heightOf(node->left->right) > heightOf(node->left->left))
+				node->left = rotateLeft(node->left);
+			return rotateRight(node);
+		}
+	}
+	return node;
+}
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline bool BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::isRed(Node* node)
+{
+	return node != nullptr && node->red;
+}
 
-template<Comparable K, CopyConstructible V>
-inline bool BinaryTree<K, V>::insertRecursive(const K& key, const V& value, Node* node)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::replaceChild(Node* parent, Node* oldChild, Node* newChild)
 {
-		if (node == root) lastOperationPassedNodes = 0;
-		lastOperationPassedNodes++;
+	replaceChild(root, parent, oldChild, newChild);
+}
 
-	
-		if (key == node->key) return false;
-		if (key > node->key) {
-			if (node->right == nullptr) {
-				Node* newNode;
-				newNode = new Node();
-				newNode->left = nullptr;
-				newNode->right = nullptr;
-				newNode->key = key;
-				newNode->value = value;
-				node->right = newNode;
-				return true;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::replaceChild(Node*& top, Node* parent, Node* oldChild, Node* newChild)
+{
+	if (parent == nullptr)
+		top = newChild;
+	else if (parent->left == oldChild)
+		parent->left = newChild;
+	else
+		parent->right = newChild;
+	if (newChild != nullptr) newChild->parent = parent;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::fixRedBlackInsert(Node* node, Node*& top)
+{
+	// Fixing "red parent of the red node" going up: recolouring moves the violation two levels higher,
+	// rotations finish the fixing
+	while (isRed(node->parent)) {
+		Node* parent = node->parent;
+		Node* grandParent = parent->parent; // exists: red node is never the root
+		Node* uncle = parent == grandParent->left ? grandParent->right : grandParent->left;
+		if (isRed(uncle)) {
+			parent->red = false;
+			uncle->red = false;
+			grandParent->red = true;
+			node = grandParent;
+			continue;
+		}
+		Node* greatGrandParent = grandParent->parent;
+		Node* subtreeRoot;
+		if (parent == grandParent->left) {
+			if (node == parent->right)
+				grandParent->left = rotateLeft(parent);
+			subtreeRoot = rotateRight(grandParent);
+		}
+		else {
+			if (node == parent->left)
+				grandParent->right = rotateRight(parent);
+			subtreeRoot = rotateLeft(grandParent);
+		}
+		subtreeRoot->red = false;
+		grandParent->red = true;
+		replaceChild(top, greatGrandParent, grandParent, subtreeRoot);
+		break;
+	}
+	top->red = false;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline bool BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::eraseRedBlack(const K& key)
+{
+	// way[0] is always nullptr (parent of the root)
+	Node* way[MAX_RED_BLACK_HEIGHT + 2];
+	size_t depth = 0;
+	way[0] = nullptr;
+	Node* target = root;
+	while (true) {
+		counters.passNode();
+		if (target == nullptr)
+			return false;
+		counters.compare();
+		std::strong_ordering order = key <=> target->key;
+		if (order == 0)
+			break;
+		way[++depth] = target;
+		target = order > 0 ? target->right : target->left;
+	}
+	size_t targetDepth = ++depth;
+	way[targetDepth] = target;
+	forgetExtremes(target);
+	if constexpr (OrderStatistics) {
+		for (size_t i = 1; i < targetDepth; i++)
+			way[i]->count--;
+	}
+
+	// The node which takes the place of the removed one (can be nullptr) and the index of its parent in the way
+	Node* replacement;
+	size_t parentDepth;
+	bool removedRed;
+	if (target->left != nullptr && target->right != nullptr) {
+		// Two children: the in-order successor is unlinked from its place and takes the target's place with its colour
+		Node* succ = target->right;
+		way[++depth] = succ;
+		while (succ->left != nullptr) {
+			counters.passNode();
+			succ = succ->left;
+			way[++depth] = succ;
+		}
+		if constexpr (OrderStatistics) {
+			for (size_t i = targetDepth + 1; i < depth; i++)
+				way[i]->count--;
+			succ->count = target->count - 1;
+		}
+		replacement = succ->right;
+		removedRed = succ->red;
+		if (succ != target->right) {
+			setLeft(way[depth - 1], succ->right);
+			setRight(succ, target->right);
+			parentDepth = depth - 1;
+		}
+		else {
+			parentDepth = targetDepth;
+		}
+		setLeft(succ, target->left);
+		succ->red = target->red;
+		replaceChild(way[targetDepth - 1], target, succ);
+		way[targetDepth] = succ;
+	}
+	else {
+		replacement = target->left != nullptr ? target->left : target->right;
+		removedRed = target->red;
+		parentDepth = targetDepth - 1;
+		replaceChild(way[parentDepth], target, replacement);
+	}
+	destroyNode(target);
+
+	// Removing a black node leaves its branch one black node short: the replacement is "double black"
+	Node* node = replacement;
+	if (!removedRed) {
+		while (way[parentDepth] != nullptr && !isRed(node)) {
+			Node* parent = way[parentDepth];
+			bool isLeft = node == parent->left;
+			Node* sibling = isLeft ? parent->right : parent->left; // exists: its branch is at least one black node high
+			if (isRed(sibling)) {
+				// Red sibling: rotate it above the parent to get the black one
+				sibling->red = false;
+				parent->red = true;
+				replaceChild(way[parentDepth - 1], parent, isLeft ? rotateLeft(parent) : rotateRight(parent));
+				way[parentDepth + 1] = parent;
+				way[parentDepth] = sibling;
+				parentDepth++;
+				sibling = isLeft ? parent->right : parent->left;
 			}
-			else {
-				return insertRecursive(key, value, node->right);
+			Node* nearNephew = isLeft ? sibling->left : sibling->right;
+			Node* farNephew = isLeft ? sibling->right : sibling->left;
+			if (!isRed(nearNephew) && !isRed(farNephew)) {
+				// Black nephews: recolour the sibling and move the shortage to the parent
+				sibling->red = true;
+				node = parent;
+				parentDepth--;
+				continue;
+			}
+			if (!isRed(farNephew)) {
+				// Near red nephew: rotate it to the far position
+				nearNephew->red = false;
+				sibling->red = true;
+				sibling = isLeft ? (parent->right = rotateRight(sibling)) : (parent->left = rotateLeft(sibling));
+				farNephew = isLeft ? sibling->right : sibling->left;
 			}
+			// Far red nephew: rotation around the parent restores the black height
+			sibling->red = parent->red;
+			parent->red = false;
+			farNephew->red = false;
+			replaceChild(way[parentDepth - 1], parent, isLeft ? rotateLeft(parent) : rotateRight(parent));
+			node = root;
+			break;
 		}
-		if (key < node->key) {
-			if (node->left == nullptr) {
-				Node* newNode;
-				newNode = new Node();
-				newNode->left = nullptr;
-				newNode->right = nullptr;
-				newNode->key = key;
-				newNode->value = value;
-				node->left = newNode;
-				return true;
+		if (node != nullptr) node->red = false;
+	}
+	return true;
+}
+
+/*==========================================================================================
+
+								  SPLIT AND JOIN
+
+===========================================================================================*/
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline size_t BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::blackHeightOf(Node* node)
+{
+	// Number of the black nodes on the way down to a leaf: the same on every way in red-black tree
+	size_t height = 0;
+	for (; node != nullptr; node = node->left)
+		if (!node->red) ++height;
+	return height;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::joinSubtrees(Node* left, Node* middle, Node* right)
+{
+	middle->parent = nullptr;
+	if constexpr (B == Balancing::AVL) {
+		// The higher tree is passed down along its inner spine to the subtree as high as the other tree (or higher by one):
+		// middle links them there and the balance is restored going up
+		unsigned char leftHeight = heightOf(left);
+		unsigned char rightHeight = heightOf(right);
+		if (leftHeight > rightHeight + 1) {
+			Node* parent = left;
+			while (heightOf(parent->right) > rightHeight + 1) parent = parent->right;
+			setLeft(middle, parent->right);
+			setRight(middle, right);
+			updateSubtreeInfo(middle);
+			setRight(parent, middle);
+			retrace(parent, left);
+			return left;
+		}
+		if (rightHeight > leftHeight + 1) {
+			Node* parent = right;
+			while (heightOf(parent->left) > leftHeight + 1) parent = parent->left;
+			setRight(middle, parent->left);
+			setLeft(middle, left);
+			updateSubtreeInfo(middle);
+			setLeft(parent, middle);
+			retrace(parent, right);
+			return right;
+		}
+	}
+	else if constexpr (B == Balancing::RedBlack) {
+		// Roots of the joined trees are black (recolouring the root keeps the tree valid). The higher tree is passed down
+		// along its inner spine to the black node with the black height of the other tree: red middle links them there,
+		// then "red parent of the red node" is fixed like after insertion
+		if (left != nullptr) left->red = false;
+		if (right != nullptr) right->red = false;
+		size_t leftBlackHeight = blackHeightOf(left);
+		size_t rightBlackHeight = blackHeightOf(right);
+		if (leftBlackHeight != rightBlackHeight) {
+			bool intoLeft = leftBlackHeight > rightBlackHeight;
+			Node* top = intoLeft ? left : right;
+			size_t targetHeight = intoLeft ? rightBlackHeight : leftBlackHeight;
+			size_t height = intoLeft ? leftBlackHeight : rightBlackHeight;
+			Node* parent = nullptr;
+			Node* node = top;
+			while (height > targetHeight || isRed(node)) {
+				if (!node->red) --height;
+				parent = node;
+				node = intoLeft ? node->right : node->left;
+			}
+			middle->red = true;
+			if (intoLeft) {
+				setLeft(middle, node);
+				setRight(middle, right);
+				setRight(parent, middle);
 			}
 			else {
-				return insertRecursive(key, value, node->left);
+				setRight(middle, node);
+				setLeft(middle, left);
+				setLeft(parent, middle);
 			}
+			updateSubtreeInfo(middle);
+			if constexpr (OrderStatistics) {
+				for (Node* ancestor = parent; ancestor != nullptr; ancestor = ancestor->parent)
+					updateSubtreeInfo(ancestor);
+			}
+			fixRedBlackInsert(middle, top);
+			return top;
 		}
+		middle->red = false;
+	}
+	// Trees of the same height (or the unbalanced tree): middle becomes the root
+	setLeft(middle, left);
+	setRight(middle, right);
+	updateSubtreeInfo(middle);
+	return middle;
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::Node* BinaryTree<K, V>::findAndCreateIfNotExists(const K& key, Node* node)
-{
-	Node* newNode = nullptr;
-	if (key == node->key) return node;
-	if (key > node->key) {
-		if (node->right == nullptr) {
-			newNode = new Node();
-			newNode->key = key;
-			newNode->value = V();
-			node->right = newNode;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::splitSubtree(Node* tree, const K& key, Node*& less, Node*& equal, Node*& greater)
+{
+	less = nullptr;
+	equal = nullptr;
+	greater = nullptr;
+	if (tree == nullptr) return;
+	// Down to the key: the nodes of the way are split off going back up, each one joins its outer subtree
+	// to the part of its side. The parts grow in height step by step, so the joins cost O(height) in total
+	Node* node = tree;
+	while (true) {
+		counters.passNode();
+		counters.compare();
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0) {
+			equal = node;
+			break;
+		}
+		Node* next = order > 0 ? node->right : node->left;
+		if (next == nullptr) break;
+		node = next;
+	}
+	if (equal != nullptr) {
+		less = equal->left;
+		greater = equal->right;
+		if (less != nullptr) less->parent = nullptr;
+		if (greater != nullptr) greater->parent = nullptr;
+		node = equal->parent;
+		equal->left = nullptr;
+		equal->right = nullptr;
+		equal->parent = nullptr;
+		updateSubtreeInfo(equal);
+	}
+	while (node != nullptr) {
+		Node* parent = node->parent;
+		if (node->key < key) {
+			Node* outer = node->left;
+			if (outer != nullptr) outer->parent = nullptr;
+			less = joinSubtrees(outer, node, less);
 		}
 		else {
-			return findAndCreateIfNotExists(key, node->right);
+			Node* outer = node->right;
+			if (outer != nullptr) outer->parent = nullptr;
+			greater = joinSubtrees(greater, node, outer);
 		}
+		node = parent;
 	}
-	if (key < node->key) {
-		if (node->left == nullptr) {
-			newNode = new Node();
-			newNode->key = key;
-			newNode->value = V();
-			node->left = newNode;
+	// The parts can be the subtrees with the red roots
+	if constexpr (B == Balancing::RedBlack) {
+		if (less != nullptr) less->red = false;
+		if (greater != nullptr) greater->red = false;
+	}
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<typename Release>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::releaseSubtree(Node* node, Release&& release)
+{
+	while (node != nullptr) {
+		if (node->left != nullptr) {
+			node = node->left;
+			continue;
 		}
-		else {
-			return findAndCreateIfNotExists(key, node->left);
+		if (node->right != nullptr) {
+			node = node->right;
+			continue;
+		}
+		Node* parent = node->parent;
+		if (parent != nullptr) {
+			if (parent->left == node) parent->left = nullptr;
+			else parent->right = nullptr;
 		}
+		release(node);
+		node = parent;
 	}
+}
 
-	size_++;
-	return newNode;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline size_t BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::eraseNodes(Node* first, Node* stop)
+{
+	// The stop node is split off with the greater keys and links them back, the first node is split off with the removed ones
+	Node* less;
+	Node* greater = nullptr;
+	if (stop != nullptr) {
+		Node* found;
+		splitSubtree(root, stop->key, less, found, greater);
+	}
+	else {
+		less = root;
+	}
+	Node* kept;
+	Node* removedFirst;
+	Node* removed;
+	splitSubtree(less, first->key, kept, removedFirst, removed);
+	root = stop != nullptr ? joinSubtrees(kept, stop, greater) : kept;
+	minNode = leftmost(root);
+	maxNode = rightmost(root);
+
+	size_t count = 1;
+	destroyNode(removedFirst);
+	releaseSubtree(removed, [&](Node* node) {
+		destroyNode(node);
+		++count;
+		});
+	size_ -= count;
+	return count;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::adoptSubtree(BinaryTree& source, Node* top)
+{
+	if (top == nullptr) return;
+	if constexpr (!std::is_empty_v<Allocator<Node>>)
+		allocator.share(source.allocator);
+	root = top;
+	minNode = leftmost(top);
+	maxNode = rightmost(top);
+	if constexpr (OrderStatistics) {
+		size_ = sizeOf(top);
+	}
+	else {
+		size_ = 0;
+		sizeUnknown = top != nullptr;
+	}
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline std::pair<BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>, BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::split(const K& key) requires Shareable<Allocator<Node>>
+{
+	counters.begin(Operation::Bulk);
+	Node* less;
+	Node* equal;
+	Node* greater;
+	splitSubtree(root, key, less, equal, greater);
+	if (equal != nullptr) greater = joinSubtrees(nullptr, equal, greater);
+	std::pair<BinaryTree, BinaryTree> parts;
+	parts.first.adoptSubtree(*this, less);
+	parts.second.adoptSubtree(*this, greater);
+	// The nodes belong to the parts: this tree only drops its share of the memory
+	root = nullptr;
+	minNode = nullptr;
+	maxNode = nullptr;
+	size_ = 0;
+	sizeUnknown = false;
+	if constexpr (BulkReleasable<Allocator<Node>>)
+		allocator.release();
+	return parts;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::join(BinaryTree&& left, BinaryTree&& right) requires Shareable<Allocator<Node>>
+{
+	if (left.maxNode != nullptr && right.minNode != nullptr && !(left.maxNode->key < right.minNode->key))
+		throw std::invalid_argument("join: keys of the left tree have to be less than keys of the right tree");
+	BinaryTree result(std::move(left));
+	if (right.root == nullptr) return result;
+	result.counters.begin(Operation::Bulk);
+	if constexpr (!std::is_empty_v<Allocator<Node>>)
+		result.allocator.share(right.allocator);
+	// The least node of the right tree links the trees
+	Node* less;
+	Node* middle;
+	Node* greater;
+	result.splitSubtree(right.root, right.minNode->key, less, middle, greater);
+	result.root = result.joinSubtrees(result.root, middle, greater);
+	if (result.minNode == nullptr) result.minNode = middle;
+	result.maxNode = right.maxNode;
+	if constexpr (OrderStatistics) {
+		result.size_ = sizeOf(result.root);
+	}
+	else {
+		result.size_ += right.size_;
+		result.sizeUnknown = result.sizeUnknown || right.sizeUnknown;
+	}
+	right.root = nullptr;
+	right.clear();
+	return result;
 }
 
 /*==========================================================================================
@@ -514,309 +1503,715 @@ inline BinaryTree<K, V>::Node* BinaryTree<K, V>::findAndCreateIfNotExists(const
 
 ===========================================================================================*/
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::BinaryTree(const BinaryTree<K, V>& other)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::BinaryTree(const BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>& other)
 {
-	other.forEachHorizontal([&](const K& key, const V& val) {
-		this->insert(key, val);
-		});
+	cloneFrom(other);
 }
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::BinaryTree(BinaryTree&& other)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::BinaryTree(BinaryTree&& other) : allocator(std::move(other.allocator))
 {
 	this->root = other.root;
 	this->size_ = other.size_;
+	this->sizeUnknown = std::exchange(other.sizeUnknown, false);
+	this->minNode = std::exchange(other.minNode, nullptr);
+	this->maxNode = std::exchange(other.maxNode, nullptr);
 	other.root = nullptr;
+	other.size_ = 0;
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>& BinaryTree<K, V>::operator=(const BinaryTree& other)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>& BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::operator=(const BinaryTree& other)
 {
 	if (this != &other) {
 		this->clear();
-		other.forEachHorizontal([&](const K& key, const V& val) {
-			this->insert(key, val);
-			});
+		cloneFrom(other);
 	}
 	return *this;
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>& BinaryTree<K, V>::operator=(BinaryTree&& other)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>& BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::operator=(BinaryTree&& other)
 {
 	if (this != &other) {
+		this->clear();
+		this->allocator = std::move(other.allocator);
 		this->root = other.root;
 		this->size_ = other.size_;
+		this->sizeUnknown = std::exchange(other.sizeUnknown, false);
+		this->minNode = std::exchange(other.minNode, nullptr);
+		this->maxNode = std::exchange(other.maxNode, nullptr);
 		other.root = nullptr;
+		other.size_ = 0;
 	}
 	return *this;
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::~BinaryTree()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::~BinaryTree()
 {
 	clear();
 }
 
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<KeyValueIterator<K, V> InputIt>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::BinaryTree(InputIt first, InputIt last)
+{
+	assign(first, last);
+}
+
+
 /*==========================================================================================
 
-								  INFORMATIONAL OPERATIONS
+								  BULK CONSTRUCTION
 
 ===========================================================================================*/
 
-template<Comparable K, CopyConstructible V>
-bool BinaryTree<K, V>::contains(const K& key) const {
-	if (findRecursive(key,root))
-		return true;
-	else
-		return false;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::linkBalanced(Node*& head, size_t count, size_t depth, size_t redDepth)
+{
+	if (count == 0) return nullptr;
+	size_t leftCount = count / 2;
+	Node* left = linkBalanced(head, leftCount, depth + 1, redDepth);
+	Node* node = head;
+	head = head->right;
+	setLeft(node, left);
+	setRight(node, linkBalanced(head, count - leftCount - 1, depth + 1, redDepth));
+	updateSubtreeInfo(node);
+	if constexpr (B == Balancing::RedBlack)
+		node->red = depth == redDepth;
+	return node;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<KeyValueIterator<K, V> InputIt>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::from_sorted(InputIt first, InputIt last)
+{
+	BinaryTree tree;
+	tree.assign_sorted(first, last);
+	return tree;
 }
 
-template<Comparable K, CopyConstructible V>
-size_t BinaryTree<K, V>::size() const {
-	return size_;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<KeyValueIterator<K, V> InputIt>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::assign_sorted(InputIt first, InputIt last)
+{
+	clear();
+	counters.begin(Operation::Bulk);
+	buildSorted([&](auto&& append) {
+		const K* lastKey = nullptr;
+		for (; first != last; ++first) {
+			auto&& element = *first;
+			const K& key = element.first;
+			if (lastKey != nullptr && !(*lastKey < key)) {
+				if (*lastKey == key) continue;
+				throw std::invalid_argument("assign_sorted: keys are not sorted");
+			}
+			lastKey = &append(key, element.second)->key;
+		}
+		});
 }
 
-template<Comparable K, CopyConstructible V>
-bool BinaryTree<K, V>::empty() const {
-	return size_ == 0;
-}
-
-template<Comparable K, CopyConstructible V>
-inline std::list<K> BinaryTree<K, V>::keys() const
-{
-	std::list<K> keys;
-	if (root == nullptr) return keys;
-	std::stack<Node*> nodes;
-	nodes.push(root);
-	while (!nodes.empty()) {
-		Node* node = nodes.top();
-		nodes.pop();
-		keys.push_back(node->key);
-		if (node->right) nodes.push(node->right);
-		if (node->left) nodes.push(node->left);
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<typename Producer>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::buildSorted(Producer&& produce)
+{
+	// Allocation pass: nodes are created in the keys order and chained through the right links
+	Node* head = nullptr;
+	Node* tail = nullptr;
+	size_t count = 0;
+	try {
+		produce([&](const K& key, const V& value) {
+			Node* node = createNode(key, value);
+			if (tail == nullptr) head = node;
+			else tail->right = node;
+			tail = node;
+			++count;
+			return node;
+			});
 	}
-	return keys;
+	catch (...) {
+		while (head != nullptr) {
+			Node* next = head->right;
+			destroyNode(head);
+			head = next;
+		}
+		throw;
+	}
+	if (count == 0) return;
+
+	// Linking pass: the middle node of every chain part becomes the root of its subtree.
+	// All levels are full except the deepest one: in red-black tree it's coloured red
+	size_t deepestLevel = 0;
+	while ((size_t(2) << deepestLevel) <= count) ++deepestLevel;
+	minNode = head;
+	maxNode = tail;
+	root = linkBalanced(head, count, 0, deepestLevel);
+	root->parent = nullptr;
+	if constexpr (B == Balancing::RedBlack)
+		root->red = false;
+	size_ = count;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<KeyValueIterator<K, V> InputIt>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::assign(InputIt first, InputIt last)
+{
+	std::vector<std::pair<K, V>> elements;
+	for (; first != last; ++first) {
+		auto&& element = *first;
+		elements.emplace_back(element.first, element.second);
+	}
+	// Stable sorting keeps the first of the pairs with equal keys first, like the repeated insert calls do
+	std::stable_sort(elements.begin(), elements.end(), [](const std::pair<K, V>& one, const std::pair<K, V>& two) {
+		return one.first < two.first;
+		});
+	assign_sorted(elements.begin(), elements.end());
 }
 
-template<Comparable K, CopyConstructible V>
-inline long BinaryTree<K, V>::getNodeDepth(K key) const {
-	return _getNodeDepth(key, root, -1);
+
+/*==========================================================================================
+
+								  SET OPERATIONS
+
+===========================================================================================*/
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::buildSetOperation(SetOperation operation, Node* one, Node* oneStop, Node* other, Node* otherStop)
+{
+	// Both sequences are passed once by the successor links: the smaller key goes first, equal keys are passed together
+	buildSorted([&](auto&& append) {
+		while (one != oneStop && other != otherStop) {
+			std::strong_ordering order = one->key <=> other->key;
+			if (order < 0) {
+				if (operation != SetOperation::Intersection) append(one->key, one->value);
+				one = successor(one);
+			}
+			else if (order > 0) {
+				if (operation == SetOperation::Union) append(other->key, other->value);
+				other = successor(other);
+			}
+			else {
+				if (operation != SetOperation::Difference) append(one->key, one->value);
+				one = successor(one);
+				other = successor(other);
+			}
+		}
+		if (operation != SetOperation::Intersection) {
+			for (; one != oneStop; one = successor(one))
+				append(one->key, one->value);
+		}
+		if (operation == SetOperation::Union) {
+			for (; other != otherStop; other = successor(other))
+				append(other->key, other->value);
+		}
+		});
 }
-template<Comparable K, CopyConstructible V>
-inline long BinaryTree<K, V>::getNodeIndex(K key) const {
-	Node* root = this->root;
-	std::stack<Node*> nodes;
-	size_t step = 0;
-	while (root != nullptr || !nodes.empty()) {
-		if (!nodes.empty()) {
-			root = nodes.top();
-			nodes.pop();
-			
-			
-			if (root->key == key) return step;
-			++step;
-
-			if (root->right != nullptr)
-				root = root->right;
-			else
-				root = nullptr;
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::parallelSetOperation(SetOperation operation, const BinaryTree& one, const BinaryTree& other, unsigned threads)
+{
+	// Splitters: the nodes of the upper levels of the bigger tree in the keys order (2^levels - 1 >= threads - 1 of them in the full levels)
+	const BinaryTree& bigger = one.size() >= other.size() ? one : other;
+	size_t levels = 0;
+	while ((size_t(1) << levels) < threads) ++levels;
+	std::vector<Node*> upperNodes;
+	std::vector<std::pair<Node*, size_t>> way;
+	Node* node = bigger.root;
+	size_t depth = 0;
+	while (true) {
+		while (node != nullptr && depth < levels) {
+			way.emplace_back(node, depth);
+			node = node->left;
+			++depth;
+		}
+		if (way.empty()) break;
+		upperNodes.push_back(way.back().first);
+		node = way.back().first->right;
+		depth = way.back().second + 1;
+		way.pop_back();
+	}
+	size_t ranges = threads < upperNodes.size() + 1 ? threads : upperNodes.size() + 1;
+	if (ranges <= 1) {
+		BinaryTree result;
+		result.buildSetOperation(operation, one.minNode, nullptr, other.minNode, nullptr);
+		return result;
+	}
+
+	// Range i is [splitter i - 1, splitter i) in both trees: its bounds are found before the threads start
+	std::vector<Node*> oneBounds(ranges + 1, nullptr);
+	std::vector<Node*> otherBounds(ranges + 1, nullptr);
+	oneBounds[0] = one.minNode;
+	otherBounds[0] = other.minNode;
+	for (size_t i = 1; i < ranges; i++) {
+		const K& splitter = upperNodes[i * (upperNodes.size() + 1) / ranges - 1]->key;
+		oneBounds[i] = one.lowerBoundNode(splitter, false);
+		otherBounds[i] = other.lowerBoundNode(splitter, false);
+	}
+	std::vector<BinaryTree> parts(ranges);
+	std::vector<std::exception_ptr> errors(ranges);
+	std::vector<std::thread> workers;
+	workers.reserve(ranges - 1);
+	auto merge = [&](size_t i) {
+		try {
+			parts[i].buildSetOperation(operation, oneBounds[i], oneBounds[i + 1], otherBounds[i], otherBounds[i + 1]);
+		}
+		catch (...) {
+			errors[i] = std::current_exception();
+		}
+	};
+	for (size_t i = 1; i < ranges; i++) {
+		try {
+			workers.emplace_back(merge, i);
 		}
-		while (root != nullptr) {
-			nodes.push(root);
-			root = root->left;
+		catch (const std::system_error&) {
+			// No more threads: the range is merged by the calling thread
+			merge(i);
 		}
 	}
-	return -1;
+	merge(0);
+	for (std::thread& worker : workers)
+		worker.join();
+	for (std::exception_ptr& error : errors) {
+		if (error) std::rethrow_exception(error);
+	}
+
+	BinaryTree result = std::move(parts[0]);
+	for (size_t i = 1; i < ranges; i++)
+		result = join(std::move(result), std::move(parts[i]));
+	return result;
 }
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::merge_union(const BinaryTree& one, const BinaryTree& other)
+{
+	BinaryTree result;
+	result.counters.begin(Operation::Bulk);
+	result.buildSetOperation(SetOperation::Union, one.minNode, nullptr, other.minNode, nullptr);
+	return result;
+}
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::intersect(const BinaryTree& one, const BinaryTree& other)
+{
+	BinaryTree result;
+	result.counters.begin(Operation::Bulk);
+	result.buildSetOperation(SetOperation::Intersection, one.minNode, nullptr, other.minNode, nullptr);
+	return result;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::difference(const BinaryTree& one, const BinaryTree& other)
+{
+	BinaryTree result;
+	result.counters.begin(Operation::Bulk);
+	result.buildSetOperation(SetOperation::Difference, one.minNode, nullptr, other.minNode, nullptr);
+	return result;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::merge_union(const BinaryTree& one, const BinaryTree& other, unsigned threads) requires Shareable<Allocator<Node>>
+{
+	return parallelSetOperation(SetOperation::Union, one, other, threads);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::intersect(const BinaryTree& one, const BinaryTree& other, unsigned threads) requires Shareable<Allocator<Node>>
+{
+	return parallelSetOperation(SetOperation::Intersection, one, other, threads);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::difference(const BinaryTree& one, const BinaryTree& other, unsigned threads) requires Shareable<Allocator<Node>>
+{
+	return parallelSetOperation(SetOperation::Difference, one, other, threads);
+}
 
 
 /*==========================================================================================
 
-								  ACCESS OPERATIONS
+								  INFORMATIONAL OPERATIONS
 
 ===========================================================================================*/
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+bool BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::contains(const K& key) const {
+	if (findNode(key))
+		return true;
+	else
+		return false;
+}
 
-template<Comparable K, CopyConstructible V>
-BinaryTree<K, V>::iterator BinaryTree<K, V>::find(const K& key) {
-	std::stack<Node*> wayFromRoot;
-	Node* result = findRecursive(key, root,wayFromRoot);
-	if (result == nullptr) return end();
-	iterator resultinIterator(result);
-	resultinIterator.nodes = wayFromRoot;
-	return resultinIterator;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+size_t BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::size() const {
+	if (sizeUnknown) {
+		size_ = 0;
+		forEachNode([&](Node*) { ++size_; });
+		sizeUnknown = false;
+	}
+	return size_;
 }
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+bool BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::empty() const {
+	return root == nullptr;
+}
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline std::vector<K> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::keys(TraversalOrder order) const
+{
+	std::vector<K> keys;
+	keys.reserve(size());
+	this->keys(std::back_inserter(keys), order);
+	return keys;
+}
 
-template<Comparable K, CopyConstructible V>
-BinaryTree<K, V>::const_iterator BinaryTree<K, V>::find(const K& key) const {
-	std::stack<Node*> wayFromRoot;
-	Node* result = findRecursive(key, root, wayFromRoot);
-	if (result == nullptr) return cend();
-	const_iterator resultinIterator(result);
-	resultinIterator.nodes = wayFromRoot;
-	resultinIterator.associatedTree = this;
-	return resultinIterator;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline std::vector<V> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::values(TraversalOrder order) const
+{
+	std::vector<V> values;
+	values.reserve(size());
+	this->values(std::back_inserter(values), order);
+	return values;
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::iterator BinaryTree<K, V>::end()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline std::vector<std::pair<K, V>> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::items(TraversalOrder order) const
 {
-	iterator a;
-	a.associatedTree = this;
-	if (this->root == nullptr) return a;
-	Node* currentNode = this->root;
-	while (currentNode) {
-		a.nodes.push(currentNode);
-		currentNode = currentNode->right;
-	}
-	a.ptr = currentNode;
-	return a;
+	std::vector<std::pair<K, V>> items;
+	items.reserve(size());
+	this->items(std::back_inserter(items), order);
+	return items;
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::const_iterator BinaryTree<K, V>::cend() const
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<std::output_iterator<const K&> Out>
+inline Out BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::keys(Out out, TraversalOrder order) const
 {
-	iterator a;
-	a.associatedTree = this;
-	if (this->root == nullptr) return a;
-	Node* currentNode = this->root;
-	while (currentNode) {
-		a.nodes.push(currentNode);
-		currentNode = currentNode->right;
+	forEachNode(order, [&](Node* node) { *out++ = node->key; });
+	return out;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<std::output_iterator<const V&> Out>
+inline Out BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::values(Out out, TraversalOrder order) const
+{
+	forEachNode(order, [&](Node* node) { *out++ = std::as_const(node->value); });
+	return out;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<std::output_iterator<std::pair<K, V>> Out>
+inline Out BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::items(Out out, TraversalOrder order) const
+{
+	forEachNode(order, [&](Node* node) { *out++ = std::pair<K, V>(node->key, node->value); });
+	return out;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline long BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::getNodeDepth(K key) const {
+	return findDepth(key);
+}
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline long BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::getNodeIndex(K key) const {
+	if constexpr (OrderStatistics) {
+		// Every left subtree and node passed on the way to the right precedes the key
+		long index = 0;
+		Node* node = this->root;
+		while (node != nullptr) {
+			std::strong_ordering order = key <=> node->key;
+			if (order == 0) return index + (long)sizeOf(node->left);
+			if (order < 0) {
+				node = node->left;
+			}
+			else {
+				index += (long)sizeOf(node->left) + 1;
+				node = node->right;
+			}
+		}
+		return -1;
 	}
-	a.ptr = currentNode;
-	return a;
+	long step = 0;
+	for (Node* node = leftmost(root); node != nullptr; node = successor(node)) {
+		if (node->key == key) return step;
+		++step;
+	}
+	return -1;
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::iterator BinaryTree<K, V>::begin()
+/*==========================================================================================
+
+								  ORDER STATISTICS
+
+===========================================================================================*/
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::selectNode(size_t index) const
 {
-	iterator a;
-	a.associatedTree = this;
-	if (this->root == nullptr) return a;
-	Node* currentNode = this->root;
-	while (currentNode->left) {
-		a.nodes.push(currentNode);
-		currentNode = currentNode->left;
+	Node* node = this->root;
+	while (node != nullptr) {
+		size_t leftSize = sizeOf(node->left);
+		if (index == leftSize) return node;
+		if (index < leftSize) {
+			node = node->left;
+		}
+		else {
+			index -= leftSize + 1;
+			node = node->right;
+		}
 	}
-	a.ptr = currentNode;
-	return a;
+	return nullptr;
 }
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::const_iterator BinaryTree<K, V>::cbegin() const
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline size_t BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::countLess(const K& key) const
 {
-	const_iterator a;
-	a.associatedTree = this;
-	Node* currentNode = this->root;
-	while (currentNode->left) {
-		a.nodes.push(currentNode);
-		currentNode = currentNode->left;
+	size_t less = 0;
+	Node* node = this->root;
+	while (node != nullptr) {
+		if (node->key < key) {
+			less += sizeOf(node->left) + 1;
+			node = node->right;
+		}
+		else {
+			node = node->left;
+		}
 	}
-	a.ptr = currentNode;
-	return a;
+	return less;
+}
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::nth(size_t index) requires OrderStatistics
+{
+	return iterator(selectNode(index), this);
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::reverse_iterator BinaryTree<K, V>::rend()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::nth(size_t index) const requires OrderStatistics
 {
-	reverse_iterator a;
-	a.associatedTree = this;
-	if (this->root == nullptr) return a;
-	Node* currentNode = this->root;
-	while (currentNode) {
-		a.nodes.push(currentNode);
-		currentNode = currentNode->left;
-	}
-	a.associatedTree = this;
-	a.ptr = currentNode;
-	return a;
+	return const_iterator(selectNode(index), this);
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::const_reverse_iterator BinaryTree<K, V>::crend() const
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline size_t BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::count_range(const K& lo, const K& hi) const requires OrderStatistics
 {
-	reverse_iterator a;
-	a.associatedTree = this;
-	if (this->root == nullptr) return a;
-	Node* currentNode = this->root;
-	while (currentNode) {
-		a.nodes.push(currentNode);
-		currentNode = currentNode->left;
-	}
-	a.associatedTree = this;
-	a.ptr = currentNode;
-	return a;
+	if (!(lo < hi)) return 0;
+	return countLess(hi) - countLess(lo);
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::reverse_iterator BinaryTree<K, V>::rbegin()
+
+/*==========================================================================================
+
+								  ACCESS OPERATIONS
+
+===========================================================================================*/
+
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::find(const K& key) {
+	Node* result = findNode(key);
+	return iterator(result, this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::find(const K& key) const {
+	Node* result = findNode(key);
+	return const_iterator(result, this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::find_from(const iterator_base& hint, const K& key) {
+	const_iterator found = std::as_const(*this).find_from(hint, key);
+	return iterator(found.ptr, this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::find_from(const iterator_base& hint, const K& key) const {
+	if (hint.associatedTree != this) throw std::logic_error("find_from: the iterator belongs to another tree");
+	counters.begin(Operation::Find);
+	Node* start = hint.ptr != nullptr ? hint.ptr : maxNode;
+	if (start == nullptr) return cend();
+	Node* parent = nullptr;
+	bool toRight = false;
+	return const_iterator(fingerSearch(start, key, parent, toRight), this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::lower_bound(const K& key) {
+	counters.begin(Operation::Find);
+	return iterator(lowerBoundNode(key, false), this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::lower_bound(const K& key) const {
+	counters.begin(Operation::Find);
+	return const_iterator(lowerBoundNode(key, false), this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::upper_bound(const K& key) {
+	counters.begin(Operation::Find);
+	return iterator(lowerBoundNode(key, true), this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::upper_bound(const K& key) const {
+	counters.begin(Operation::Find);
+	return const_iterator(lowerBoundNode(key, true), this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline std::pair<typename BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator, typename BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::equal_range(const K& key) {
+	counters.begin(Operation::Find);
+	// Keys are unique: the range is the found element or empty
+	Node* lower = lowerBoundNode(key, false);
+	Node* upper = lower != nullptr && lower->key == key ? successor(lower) : lower;
+	return { iterator(lower, this), iterator(upper, this) };
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline std::pair<typename BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator, typename BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::equal_range(const K& key) const {
+	counters.begin(Operation::Find);
+	// Keys are unique: the range is the found element or empty
+	Node* lower = lowerBoundNode(key, false);
+	Node* upper = lower != nullptr && lower->key == key ? successor(lower) : lower;
+	return { const_iterator(lower, this), const_iterator(upper, this) };
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::floor(const K& key) {
+	counters.begin(Operation::Find);
+	return iterator(floorNode(key, false), this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::floor(const K& key) const {
+	counters.begin(Operation::Find);
+	return const_iterator(floorNode(key, false), this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::ceiling(const K& key) {
+	return lower_bound(key);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::ceiling(const K& key) const {
+	return lower_bound(key);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::range_view BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::range(const K& lo, const K& hi) {
+	const_range_view view = std::as_const(*this).range(lo, hi);
+	return range_view(view.first.ptr, view.last.ptr, view.rfirst.ptr, view.rlast.ptr, this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_range_view BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::range(const K& lo, const K& hi) const {
+	counters.begin(Operation::Find);
+	Node* first = lowerBoundNode(lo, false);
+	// The element behind the range: the first one not less than hi
+	Node* last = lo < hi ? lowerBoundNode(hi, false) : first;
+	// Reverse iterators point at the elements before the bounds
+	Node* rfirst = last != nullptr ? predecessor(last) : maxNode;
+	Node* rlast = first != nullptr ? predecessor(first) : maxNode;
+	return const_range_view(first, last, rfirst, rlast, this);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::end()
 {
-	reverse_iterator a;
-	a.associatedTree = this;
-	if (this->root == nullptr) return a;
-	Node* currentNode = this->root;
-	while (currentNode->right) {
-		a.nodes.push(currentNode);
-		currentNode = currentNode->right;
-	}
-	a.associatedTree = this;
-	a.ptr = currentNode;
-	return a;
+	return iterator(nullptr, this);
 }
 
-template<Comparable K, CopyConstructible V>
-inline BinaryTree<K, V>::const_reverse_iterator BinaryTree<K, V>::crbegin() const
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::cend() const
 {
-	reverse_iterator a;
-	a.associatedTree = this;
-	if (this->root == nullptr) return a;
-	Node* currentNode = this->root;
-	while (currentNode->right) {
-		a.nodes.push(currentNode);
-		currentNode = currentNode->right;
-	}
-	a.associatedTree = this;
-	a.ptr = currentNode;
-	return a;
+	return const_iterator(nullptr, this);
 }
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::begin()
+{
+	return iterator(minNode, this);
+}
 
-template<Comparable K, CopyConstructible V>
-inline V& BinaryTree<K, V>::operator[](const K& key)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::cbegin() const
 {
+	return const_iterator(minNode, this);
+}
 
-	Node* currentNode = root;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::reverse_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::rend()
+{
+	return reverse_iterator(nullptr, this);
+}
 
-	if (currentNode == nullptr) {
-		Node* newNode = new Node();
-		newNode->key = key;
-		root = newNode;
-		size_++;
-		return root->value;
-	}
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_reverse_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::crend() const
+{
+	return const_reverse_iterator(nullptr, this);
+}
 
-	return findAndCreateIfNotExists(key, root)->value;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::reverse_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::rbegin()
+{
+	return reverse_iterator(maxNode, this);
 }
 
-template<Comparable K, CopyConstructible V>
-inline V& BinaryTree<K, V>::at(const K& key) {
-	auto it = (find(key));
-	if (it.ptr == nullptr) throw std::out_of_range("operation at: no such key in the tree");
-	return (*it).second;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::const_reverse_iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::crbegin() const
+{
+	return const_reverse_iterator(maxNode, this);
 }
 
-template<Comparable K, CopyConstructible V>
-inline const V& BinaryTree<K, V>::at(const K& key) const {
-	auto it = (find(key));
-	if (it.ptr == nullptr) throw std::out_of_range("operation at: no such key in the tree");
-	return (*it).second;
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline V& BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::operator[](const K& key)
+{
+	counters.begin(Operation::Insert);
+	Node* parent = nullptr;
+	bool toRight = false;
+	Node* node = descend(root, key, parent, toRight);
+	if (node != nullptr) return node->value;
+	// The default value is made only for the new node, right in its place
+	node = attachNode(parent, toRight, key);
+	++size_;
+	return node->value;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline V& BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::at(const K& key) {
+	Node* node = findNode(key);
+	if (node == nullptr) throw std::out_of_range("operation at: no such key in the tree");
+	return node->value;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline const V& BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::at(const K& key) const {
+	Node* node = findNode(key);
+	if (node == nullptr) throw std::out_of_range("operation at: no such key in the tree");
+	return node->value;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline V* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::try_get(const K& key) {
+	Node* node = findNode(key);
+	return node == nullptr ? nullptr : &node->value;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline const V* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::try_get(const K& key) const {
+	Node* node = findNode(key);
+	return node == nullptr ? nullptr : &node->value;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline V BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::get_or(const K& key, const V& defaultValue) const {
+	Node* node = findNode(key);
+	return node == nullptr ? defaultValue : node->value;
 }
 
 /*==========================================================================================
@@ -825,54 +2220,105 @@ inline const V& BinaryTree<K, V>::at(const K& key) const {
 
 ===========================================================================================*/
 
-template<Comparable K, CopyConstructible V>
-inline bool BinaryTree<K, V>::insert(const K& key, const V& value)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline bool BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::insert(const K& key, const V& value)
 {
-	Node* currentNode = root;
+	counters.begin(Operation::Insert);
+	bool inserted = false;
+	insertNode(key, value, inserted);
+	if (inserted) ++size_;
+	return inserted;
+}
 
-	if (currentNode == nullptr) {
-		Node* newNode = new Node();
-		newNode->key = key;
-		newNode->value = value;
-		root = newNode;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::insert(const iterator_base& hint, const K& key, const V& value)
+{
+	if (hint.associatedTree != this) throw std::logic_error("insert with hint: the iterator belongs to another tree");
+	counters.begin(Operation::Insert);
+	Node* start = hint.ptr != nullptr ? hint.ptr : maxNode;
+	Node* parent = nullptr;
+	bool toRight = false;
+	Node* node = start != nullptr ? fingerSearch(start, key, parent, toRight) : nullptr;
+	if (node == nullptr) {
+		node = attachNode(parent, toRight, key, value);
 		++size_;
-		return true;
 	}
-	bool result = insertRecursive(key, value, root);
-	if (result) ++size_;
-	return result;
+	return iterator(node, this);
 }
 
-template<Comparable K, CopyConstructible V>
-inline bool BinaryTree<K, V>::insert(std::pair<const K&, const V&> pair)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline bool BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::insert(std::pair<const K&, const V&> pair)
 {
 	return insert(pair.first, pair.second);
 }
 
-template<Comparable K, CopyConstructible V>
-inline bool BinaryTree<K, V>::erase(const K& key)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline bool BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::erase(const K& key)
 {
 	bool success = true;
-	
-	root = eraseRecursive(root, key, success);
+	counters.begin(Operation::Erase);
+	if constexpr (B == Balancing::RedBlack) {
+		success = eraseRedBlack(key);
+	}
+	else {
+		success = eraseNode(key);
+	}
 	if (success) --size_;
 	return success;
 }
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::clear()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::erase(const_iterator first, const_iterator last)
 {
-	std::stack<Node*> toDelete;
-	forEachInternal([&](Node* node) {
-		toDelete.push(node);
-	});
+	if (first.associatedTree != this || last.associatedTree != this) throw std::logic_error("erase of the range: the iterator belongs to another tree");
+	if (last.ptr != nullptr && (first.ptr == nullptr || last.ptr->key < first.ptr->key)) throw std::logic_error("erase of the range: the range end is before its begin");
+	if (first == last) return iterator(last.ptr, this);
+	counters.begin(Operation::Erase);
+	if (first.ptr == minNode && last.ptr == nullptr) {
+		// The whole tree: pool allocators release it at once
+		clear();
+		return end();
+	}
+	eraseNodes(first.ptr, last.ptr);
+	return iterator(last.ptr, this);
+}
 
-	while (!toDelete.empty()) {
-		delete toDelete.top();
-		toDelete.pop();
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline size_t BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::erase_range(const K& lo, const K& hi)
+{
+	if (!(lo < hi)) return 0;
+	counters.begin(Operation::Erase);
+	Node* first = lowerBoundNode(lo, false);
+	Node* stop = lowerBoundNode(hi, false);
+	if (first == stop) return 0;
+	if (first == minNode && stop == nullptr) {
+		size_t count = size();
+		clear();
+		return count;
 	}
+	return eraseNodes(first, stop);
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::clear()
+{
+	counters.begin(Operation::Bulk);
+	// Pool allocators free all the memory at once: nodes are visited only if they need the destructor call
+	if constexpr (!BulkReleasable<Allocator<Node>> || !std::is_trivially_destructible_v<Node>) {
+		releaseSubtree(root, [&](Node* node) {
+			if constexpr (BulkReleasable<Allocator<Node>>)
+				node->~Node();
+			else
+				destroyNode(node);
+			});
+	}
+	if constexpr (BulkReleasable<Allocator<Node>>)
+		allocator.release();
 	root = nullptr;
+	minNode = nullptr;
+	maxNode = nullptr;
 	size_ = 0;
+	sizeUnknown = false;
 }
 
 /*==========================================================================================
@@ -881,54 +2327,28 @@ inline void BinaryTree<K, V>::clear()
 
 ===========================================================================================*/
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forEachInternal(std::function<void(K&, V&)> func) const {
-	Node* root = this->root;
-	std::stack<Node*> nodes;
-	while (root != nullptr || !nodes.empty()) {
-		if (!nodes.empty()) {
-			root = nodes.top();
-			nodes.pop();
-			func(root->key, root->value);
-			if (root->right != nullptr)
-				root = root->right;
-			else
-				root = nullptr;
-		}
-		while (root != nullptr) {
-			nodes.push(root);
-			root = root->left;
-		}
-	}
-
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<typename Visitor>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forEachNode(Visitor&& visit) const {
+	for (Node* node = leftmost(root); node != nullptr; node = successor(node))
+		visit(node);
 }
 
-
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forEachInternal(std::function<void(typename BinaryTree<K, V>::Node*)> func) {
-	Node* root = this->root;
-	std::stack<Node*> nodes;
-	while (root != nullptr || !nodes.empty()) {
-		if (!nodes.empty()) {
-			root = nodes.top();
-			nodes.pop();
-			func(root);
-			if (root->right != nullptr)
-				root = root->right;
-			else
-				root = nullptr;
-		}
-		while (root != nullptr) {
-			nodes.push(root);
-			root = root->left;
-		}
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<typename Visitor>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forEachNode(TraversalOrder order, Visitor&& visit) const {
+	if (order == TraversalOrder::Sorted) {
+		forEachNode(visit);
+		return;
 	}
-
+	for (Node* node = root; node != nullptr; node = preorderNext(node))
+		visit(node);
 }
 
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forEachHorizontalInternal(std::function<void(K& key, V& val, size_t depth, size_t ordinalNumber)> func) const {
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<typename Visitor>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forEachHorizontalInternal(Visitor&& visit) const {
 	if (this->root == nullptr) return;
 	Node* root = this->root;
 	size_t depth = 0;
@@ -943,7 +2363,7 @@ inline void BinaryTree<K, V>::forEachHorizontalInternal(std::function<void(K& ke
 	do {
 		if (!nodes.empty()) nodes.pop();
 
-		func(root->key, root->value, depth, ordinalNumber);
+		visit(root, depth, ordinalNumber);
 
 		if (root->left != nullptr) nodes.push(nodeToGo(root->left, depth + 1, ordinalNumber * 2));
 		if (root->right != nullptr) nodes.push(nodeToGo(root->right, depth + 1, ordinalNumber * 2 + 1));
@@ -954,39 +2374,32 @@ inline void BinaryTree<K, V>::forEachHorizontalInternal(std::function<void(K& ke
 		}
 	} while (!nodes.empty());
 }
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forEach(std::function<void(const K&, V&)> func) {
-	forEachInternal((std::function<void(K&, V&)>)func);
-}
-
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forEach(std::function<void(const K&, const V&)> func) const {
-	forEachInternal((std::function<void(K&, V&)>)func);
-}
-
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forEachHorizontal(std::function<void(const K&, const V&)> func) const {
 
-	auto function = ([&](K& key, V& val, size_t depth, size_t ordinalNumber) {
-		func(key, val);
-		});
-	forEachHorizontalInternal(function);
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<std::invocable<const K&, V&> Func>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forEach(Func&& func) {
+	forEachNode([&](Node* node) { func(node->key, node->value); });
 }
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forEachHorizontal(std::function<void(const K&, const V&, size_t)> func) const {
 
-	auto function = ([&](K& key, V& val, size_t depth, size_t ordinalNumber) {
-		func(key, val, depth);
-		});
-	forEachHorizontalInternal(function);
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<std::invocable<const K&, const V&> Func>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forEach(Func&& func) const {
+	forEachNode([&](Node* node) { func(node->key, std::as_const(node->value)); });
 }
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forEachHorizontal(std::function<void(const K&, const V&, size_t, size_t)> func) const {
 
-	auto function = ([&](K& key, V& val, size_t depth, size_t ordinalNumber) {
-		func(key, val, depth, ordinalNumber);
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+template<typename Func>
+	requires std::invocable<Func&, const K&, const V&> || std::invocable<Func&, const K&, const V&, size_t> || std::invocable<Func&, const K&, const V&, size_t, size_t>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forEachHorizontal(Func&& func) const {
+	forEachHorizontalInternal([&](Node* node, size_t depth, size_t ordinalNumber) {
+		const V& value = node->value;
+		if constexpr (std::invocable<Func&, const K&, const V&, size_t, size_t>)
+			func(node->key, value, depth, ordinalNumber);
+		else if constexpr (std::invocable<Func&, const K&, const V&, size_t>)
+			func(node->key, value, depth);
+		else
+			func(node->key, value);
 		});
-	forEachHorizontalInternal(function);
 }
 
 /*==========================================================================================
@@ -995,212 +2408,124 @@ inline void BinaryTree<K, V>::forEachHorizontal(std::function<void(const K&, con
 
 ===========================================================================================*/
 
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::leftmost(Node* node)
+{
+	if (node == nullptr) return nullptr;
+	while (node->left != nullptr) node = node->left;
+	return node;
+}
 
-template<Comparable K, CopyConstructible V>
-BinaryTree<K, V>::iterator_base::iterator_base(BinaryTree::Node* node) {
-	ptr = node;
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::rightmost(Node* node)
+{
+	if (node == nullptr) return nullptr;
+	while (node->right != nullptr) node = node->right;
+	return node;
 }
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::iterator_base::copy(const iterator_base& other)
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::successor(Node* node)
+{
+	// The least node of the right subtree if it exists
+	if (node->right != nullptr) return leftmost(node->right);
+	// Otherwise the first parent with the bigger key: go up while coming from the right
+	while (node->parent != nullptr && node == node->parent->right)
+		node = node->parent;
+	return node->parent;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::predecessor(Node* node)
+{
+	// Mirrored successor
+	if (node->left != nullptr) return rightmost(node->left);
+	while (node->parent != nullptr && node == node->parent->left)
+		node = node->parent;
+	return node->parent;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::Node* BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::preorderNext(Node* node)
+{
+	if (node->left != nullptr) return node->left;
+	if (node->right != nullptr) return node->right;
+	// Subtree is passed: the right subtree of the nearest parent reached from the left is the next one
+	while (node->parent != nullptr) {
+		Node* parent = node->parent;
+		if (node == parent->left && parent->right != nullptr) return parent->right;
+		node = parent;
+	}
+	return nullptr;
+}
+
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator_base::copy(const iterator_base& other)
 {
 	this->ptr = other.ptr;
-	this->nodes = other.nodes;
 	this->associatedTree = other.associatedTree;
-	
 }
 
-template<Comparable K, CopyConstructible V>
-inline std::pair<const K&, V&> BinaryTree<K, V>::iterator_base::get() const
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline std::pair<const K&, V&> BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::iterator_base::get() const
 {
 	if (this->ptr == nullptr) throw std::logic_error("Iterator operation *: can't get the value of the end/rend node");
 	return std::pair<const K&, V&>(this->ptr->key, this->ptr->value);
 }
 
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forward_iterator_base::goForward()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forward_iterator_base::goForward()
 {
 	if (this->ptr == nullptr) throw std::logic_error("Iterator forward operation: can't go through the end node");
-	
-	// Get the right node if it's possible
-	if (this->ptr->right) {
-		this->nodes.push(this->ptr);
-		this->ptr = this->ptr->right;
-		// Go down through the left branch
-		while (this->ptr->left) {
-			this->nodes.push(this->ptr);
-			this->ptr = this->ptr->left;
-		}
-		return;
-
-	}
-	// If there is no right nodes : go to the first parent with the bigger key
-	std::stack<Node*> nodesTemp = this->nodes;
-	while (!nodesTemp.empty() && nodesTemp.top()->key < this->ptr->key) {
-		nodesTemp.pop();
-	}
-	// If that parent exists set iterator to it
-	if (!nodesTemp.empty()) {
-		this->ptr = nodesTemp.top();
-		nodesTemp.pop();
-		this->nodes = nodesTemp;
-	}
-	// If that parent doesn't exists: we are in the end node
-	else {
-		this->nodes.push(this->ptr);
-		this->ptr = nullptr;
-	}
-
+	// Successor of the last node is nullptr: we are in the end node
+	this->ptr = successor(this->ptr);
 }
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::forward_iterator_base::goBackward()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::forward_iterator_base::goBackward()
 {
 	if (this->ptr == nullptr) {
-		if (!this->nodes.empty()) {
-			this->ptr = this->nodes.top();
-			//validation
-			while (this->ptr->right) {
-				this->ptr = this->ptr->right;
-				this->nodes.push(this->ptr);
-			}
-			//validation end
-			this->nodes.pop();
+		// From the end node to the last one
+		if (this->associatedTree != nullptr && this->associatedTree->root != nullptr) {
+			this->ptr = this->associatedTree->maxNode;
 			return;
 		}
-		else {
-			//validation
-			if (this->associatedTree->size() > 0) {
-				this->copy(this->associatedTree->cend());
-				this->goBackward();
-				return;
-			}
-			else throw std::logic_error("Iterator going back operation: can't go through the begin node");
-		}
-	}
-
-	// Get the left node if it's possible
-	if (this->ptr->left) {
-		this->nodes.push(this->ptr);
-		this->ptr = this->ptr->left;
-		// Go down through the right branch
-		while (this->ptr->right) {
-			this->nodes.push(this->ptr);
-			this->ptr = this->ptr->right;
-		}
-		return;
-
-	}
-	// If there is no right nodes : go to the first parent with the less key
-	std::stack<Node*> nodesTemp = this->nodes;
-	while (!nodesTemp.empty() && nodesTemp.top()->key > this->ptr->key) {
-		nodesTemp.pop();
-	}
-	// If that parent exists set iterator to it
-	if (!nodesTemp.empty()) {
-		this->ptr = nodesTemp.top();
-		nodesTemp.pop();
-		this->nodes = nodesTemp;
-	}
-	// If that parent doesn't exists: we are in the begin node
-	else {
 		throw std::logic_error("Iterator going back operation: can't go through the begin node");
 	}
+	Node* previous = predecessor(this->ptr);
+	// If there is no previous node: we are in the begin node
+	if (previous == nullptr) throw std::logic_error("Iterator going back operation: can't go through the begin node");
+	this->ptr = previous;
 }
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::reverse_iterator_base::goForward()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::reverse_iterator_base::goForward()
 {
 	if (this->ptr == nullptr) throw std::logic_error("Reverse iterator forward operation: can't go through the rend node");
-
-	// Get the left node if it's possible
-	if (this->ptr->left) {
-		this->nodes.push(this->ptr);
-		this->ptr = this->ptr->left;
-		// Go down through the right branch
-		while (this->ptr->right) {
-			this->nodes.push(this->ptr);
-			this->ptr = this->ptr->right;
-		}
-		return;
-
-	}
-	// If there is no right nodes : go to the first parent with the less key
-	std::stack<Node*> nodesTemp = this->nodes;
-	while (!nodesTemp.empty() && nodesTemp.top()->key > this->ptr->key) {
-		nodesTemp.pop();
-	}
-	// If that parent exists set iterator to it
-	if (!nodesTemp.empty()) {
-		this->ptr = nodesTemp.top();
-		nodesTemp.pop();
-		this->nodes = nodesTemp;
-	}
-	// If that parent doesn't exists: we are in the end node
-	else {
-		this->nodes.push(this->ptr);
-		this->ptr = nullptr;
-	}
+	// Predecessor of the first node is nullptr: we are in the rend node
+	this->ptr = predecessor(this->ptr);
 }
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::reverse_iterator_base::goBackward()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::reverse_iterator_base::goBackward()
 {
 	if (this->ptr == nullptr) {
-		if (!this->nodes.empty()) {
-			this->ptr = this->nodes.top();
-			// Validation
-			while (this->ptr->left) {
-				this->ptr = this->ptr->left;
-				this->nodes.push(this->ptr);
-			}
-			// Validation end
-			this->nodes.pop();
+		// From the rend node to the first one
+		if (this->associatedTree != nullptr && this->associatedTree->root != nullptr) {
+			this->ptr = this->associatedTree->minNode;
 			return;
 		}
-		else {
-			//validation
-			if (this->associatedTree->size() > 0) {
-				this->copy(this->associatedTree->crend());
-				this->goBackward();
-				return;
-			}
-			else throw std::logic_error("Reverse iterator going back operation: can't go through the rbegin node");
-		}
-	}
-
-	// Get the right node if it's possible
-	if (this->ptr->right) {
-		this->nodes.push(this->ptr);
-		this->ptr = this->ptr->right;
-		// Go down through the left branch
-		while (this->ptr->left) {
-			this->nodes.push(this->ptr);
-			this->ptr = this->ptr->left;
-		}
-		return;
-
-	}
-	// If there is no right nodes : go to the first parent with the bigger key
-	std::stack<Node*> nodesTemp = this->nodes;
-	while (!nodesTemp.empty() && nodesTemp.top()->key < this->ptr->key) {
-		nodesTemp.pop();
-	}
-	// If that parent exists set iterator to it
-	if (!nodesTemp.empty()) {
-		this->ptr = nodesTemp.top();
-		nodesTemp.pop();
-		this->nodes = nodesTemp;
-	}
-	// If that parent doesn't exists: we are in the begin node
-	else {
 		throw std::logic_error("Reverse iterator going back operation: can't go through the rbegin node");
 	}
+	Node* next = successor(this->ptr);
+	// If there is no next node: we are in the rbegin node
+	if (next == nullptr) throw std::logic_error("Reverse iterator going back operation: can't go through the rbegin node");
+	this->ptr = next;
 }
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::print()
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::print()
 {
 
 	int MAXIMUM_LEVEL = 5;
@@ -1264,8 +2589,8 @@ inline void BinaryTree<K, V>::print()
 }
 
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::verticalPrint(Node* currentNode, int level) {
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::verticalPrint(Node* currentNode, int level) {
 
 	if (currentNode == nullptr)
 		return;
@@ -1278,8 +2603,8 @@ inline void BinaryTree<K, V>::verticalPrint(Node* currentNode, int level) {
 
 }
 
-template<Comparable K, CopyConstructible V>
-inline void BinaryTree<K, V>::verticalPrint() {
+template<Comparable K, CopyConstructible V, Balancing B, template<typename> class Allocator, bool OrderStatistics, class Instrumentation>
+inline void BinaryTree<K, V, B, Allocator, OrderStatistics, Instrumentation>::verticalPrint() {
 	verticalPrint(root, 0);
 }
 
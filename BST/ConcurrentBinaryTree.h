@@ -0,0 +1,250 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <optional>
+#include <thread>
+#include "BinaryTree.h"
+
+// Writer-preferring reader-writer lock with the distributed reader counters.
+// Every reader thread increments the counter of its own slot (slots are on separate cache lines),
+// so the readers of different cores don't write the same memory and shared locking scales with the cores.
+// The writer raises the flag (new readers wait from this moment: writers are never starved) and waits for all the slots to be empty.
+// Meets the SharedMutex requirements used by std::unique_lock and std::shared_lock (blocking and try_to_lock)
+class WriterPreferringSharedMutex
+{
+	static constexpr size_t CACHE_LINE = 64;
+	static constexpr size_t SLOTS = 64;
+
+	struct alignas(CACHE_LINE) Slot {
+		std::atomic<size_t> readers = 0;
+	};
+
+	Slot slots[SLOTS];
+	// A writer holds the lock or waits for the readers
+	alignas(CACHE_LINE) std::atomic<bool> writing = false;
+	std::mutex writers;
+
+	// Threads are bound to the slots in the order of their first shared locking
+	static Slot& slotOf(Slot* slots) {
+		static std::atomic<size_t> threads = 0;
+		thread_local size_t index = threads.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+		return slots[index];
+	}
+
+public:
+	WriterPreferringSharedMutex() = default;
+	WriterPreferringSharedMutex(const WriterPreferringSharedMutex&) = delete;
+	WriterPreferringSharedMutex& operator=(const WriterPreferringSharedMutex&) = delete;
+
+	void lock() {
+		writers.lock();
+		// Sequentially consistent flag and counters: either the reader sees the flag or the writer sees the reader
+		writing.store(true);
+		for (Slot& slot : slots) {
+			size_t readers;
+			while ((readers = slot.readers.load()) != 0)
+				slot.readers.wait(readers);
+		}
+	}
+
+	// Fails if another writer holds the lock or any reader is inside
+	bool try_lock() {
+		if (!writers.try_lock())
+			return false;
+		writing.store(true);
+		for (Slot& slot : slots)
+			if (slot.readers.load() != 0) {
+				unlock();
+				return false;
+			}
+		return true;
+	}
+
+	void unlock() {
+		writing.store(false);
+		writing.notify_all();
+		writers.unlock();
+	}
+
+	void lock_shared() {
+		Slot& slot = slotOf(slots);
+		while (true) {
+			slot.readers.fetch_add(1);
+			if (!writing.load()) return;
+			// The writer goes first
+			unlockSlot(slot);
+			writing.wait(true);
+		}
+	}
+
+	// Fails if a writer holds the lock or waits for it
+	bool try_lock_shared() {
+		Slot& slot = slotOf(slots);
+		slot.readers.fetch_add(1);
+		if (!writing.load())
+			return true;
+		unlockSlot(slot);
+		return false;
+	}
+
+	void unlock_shared() {
+		unlockSlot(slotOf(slots));
+	}
+
+private:
+	void unlockSlot(Slot& slot) {
+		// The waiting writer is woken up by the last reader of the slot
+		if (slot.readers.fetch_sub(1) == 1 && writing.load())
+			slot.readers.notify_all();
+	}
+};
+
+// Thread-safe facade of BinaryTree. Any number of threads run the lookups and the range scans in parallel,
+// the modifications are serialized by the writer-preferring lock.
+// Read paths of the tree are const and write nothing: the tree is not instrumented.
+// Access methods return the copies of the values: references would outlive the lock
+template <Comparable K, CopyConstructible V, Balancing B = Balancing::None, template<typename> class Allocator = NodePool, bool OrderStatistics = false>
+class ConcurrentBinaryTree
+{
+public:
+	using Tree = BinaryTree<K, V, B, Allocator, OrderStatistics>;
+
+private:
+	Tree tree;
+	mutable WriterPreferringSharedMutex mutex;
+
+public:
+	/*==========================================
+	                CONSTRUCTION
+	==========================================*/
+
+	ConcurrentBinaryTree() {};
+	// Takes the content of the tree
+	explicit ConcurrentBinaryTree(Tree&& content) : tree(std::move(content)) {
+		// Split trees count their size lazily: it's done here, so size() of the readers writes nothing
+		tree.size();
+	};
+	ConcurrentBinaryTree(const ConcurrentBinaryTree&) = delete;
+	ConcurrentBinaryTree& operator=(const ConcurrentBinaryTree&) = delete;
+
+	/*==========================================
+	             READING (SHARED LOCK)
+	==========================================*/
+
+	bool contains(const K& key) const {
+		std::shared_lock lock(mutex);
+		return tree.contains(key);
+	}
+
+	size_t size() const {
+		std::shared_lock lock(mutex);
+		return tree.size();
+	}
+
+	bool empty() const {
+		std::shared_lock lock(mutex);
+		return tree.empty();
+	}
+
+	// Returns the copy of the value. Throws out_of_range exception if tree doesn't contain the provided key
+	V at(const K& key) const {
+		std::shared_lock lock(mutex);
+		return tree.at(key);
+	}
+
+	// Returns the copy of the value or nothing if tree doesn't contain the provided key
+	std::optional<V> find(const K& key) const {
+		std::shared_lock lock(mutex);
+		const V* value = tree.try_get(key);
+		return value != nullptr ? std::optional<V>(*value) : std::nullopt;
+	}
+
+	V get_or(const K& key, const V& defaultValue) const {
+		std::shared_lock lock(mutex);
+		return tree.get_or(key, defaultValue);
+	}
+
+	// Calls func(key, value) for the elements with the keys in [lo, hi) in the keys order: O(log n + k) under one shared lock.
+	// func must not access this container
+	template<std::invocable<const K&, const V&> Func>
+	void for_each_in_range(const K& lo, const K& hi, Func&& func) const {
+		std::shared_lock lock(mutex);
+		for (auto [key, value] : tree.range(lo, hi))
+			func(key, value);
+	}
+
+	// Returns the copies of the elements with the keys in [lo, hi)
+	std::vector<std::pair<K, V>> items_in_range(const K& lo, const K& hi) const {
+		std::vector<std::pair<K, V>> items;
+		for_each_in_range(lo, hi, [&](const K& key, const V& value) { items.emplace_back(key, value); });
+		return items;
+	}
+
+	// Calls func(key, value) for every element in the keys order under one shared lock. func must not access this container
+	template<std::invocable<const K&, const V&> Func>
+	void forEach(Func&& func) const {
+		std::shared_lock lock(mutex);
+		tree.forEach(func);
+	}
+
+	std::vector<std::pair<K, V>> items() const {
+		std::shared_lock lock(mutex);
+		return tree.items();
+	}
+
+	// Calls func(const Tree&) under the shared lock: several reading operations see the same state of the tree.
+	// The result must not refer to the tree content
+	template<std::invocable<const Tree&> Func>
+	decltype(auto) read(Func&& func) const {
+		std::shared_lock lock(mutex);
+		return func(std::as_const(tree));
+	}
+
+	/*==========================================
+	           MODIFYING (EXCLUSIVE LOCK)
+	==========================================*/
+
+	// Inserts the new key:value pair. Returns false if tree already contains the key
+	bool insert(const K& key, const V& value) {
+		std::unique_lock lock(mutex);
+		return tree.insert(key, value);
+	}
+
+	// Inserts the pair or replaces the value of the existing key
+	void insert_or_assign(const K& key, const V& value) {
+		std::unique_lock lock(mutex);
+		if (V* existing = tree.try_get(key))
+			*existing = value;
+		else
+			tree.insert(key, value);
+	}
+
+	bool erase(const K& key) {
+		std::unique_lock lock(mutex);
+		return tree.erase(key);
+	}
+
+	// Removes the elements with the keys in [lo, hi). Returns the number of removed elements
+	size_t erase_range(const K& lo, const K& hi) {
+		std::unique_lock lock(mutex);
+		return tree.erase_range(lo, hi);
+	}
+
+	void clear() {
+		std::unique_lock lock(mutex);
+		tree.clear();
+	}
+
+	// Calls func(Tree&) under the exclusive lock: several modifications are applied atomically
+	template<std::invocable<Tree&> Func>
+	decltype(auto) write(Func&& func) {
+		std::unique_lock lock(mutex);
+		// The tree can get the lazy size (see BinaryTree::split): it's counted before the readers come
+		struct SizeCounter {
+			Tree& tree;
+			~SizeCounter() { tree.size(); }
+		} sizeCounter{ tree };
+		return func(tree);
+	}
+};
@@ -0,0 +1,284 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <new>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "NodePool.h"
+
+// Epoch-based reclamation of the objects read without locks (the nodes of the concurrent containers).
+//
+// A thread pins the reclaimer before it reads the shared objects and unpins it when it holds no pointers to them
+// (see Guard): the pin announces the global epoch the thread has seen. An object unlinked from the shared structure is retired
+// with the current epoch, and it's destroyed when the global epoch is 2 epochs ahead. The epoch advances only when every pinned
+// thread has announced the current one, so a thread that could see the object before its unlinking has unpinned by then.
+// A thread stopped inside a pinned section (preempted) holds the epoch back: the objects retired meanwhile wait for it.
+//
+// Every thread has its own record: the announced epoch, the list of its retired objects and its own allocator.
+// Objects are created from the allocator of the creating thread, and their memory goes back to the same allocator: every object
+// remembers the record of its creator, and a thread freeing the object of another thread pushes it to the lock-free list of
+// the returned memory of the creator. The creator takes the whole list back when it creates objects. So the allocators
+// (NodePool by default) are used by their threads only and need no synchronization, and a thread that only inserts reuses
+// the nodes erased by the others. The memory goes back to the system when the reclaimer is destroyed.
+// A thread frees its retired objects when it leaves the outermost pinned section, and every COLLECT_BATCH retirements
+// inside a long section: it tries to advance the epoch and destroys the objects that became safe.
+//
+// Records are never removed: a thread keeps its record while it lives, and a new thread with the same id takes it over.
+// The few objects a finished thread couldn't free when it left its last section are destroyed with the reclaimer
+template<typename T, template<typename> class Allocator = NodePool>
+class EpochReclaimer
+{
+public:
+	// Retirements between the attempts to free the retired objects
+	static constexpr size_t COLLECT_BATCH = 64;
+
+private:
+	struct Record;
+
+	// Memory of one object with the record of the thread that created it
+	struct Block {
+		Record* const owner;
+		union {
+			alignas(T) unsigned char storage[sizeof(T)];
+			// In the returned list of the owner, when the object is destroyed
+			Block* next;
+		};
+
+		explicit Block(Record* owner) : owner(owner) {}
+
+		static Block* of(T* object) {
+			return reinterpret_cast<Block*>(reinterpret_cast<unsigned char*>(object) - offsetof(Block, storage));
+		}
+	};
+
+	struct Retired {
+		T* object;
+		uint64_t epoch;
+	};
+
+	static constexpr size_t CACHE_LINE = 64;
+
+	struct alignas(CACHE_LINE) Record {
+		// (announced epoch << 1) | 1 while the thread is pinned, 0 otherwise
+		std::atomic<uint64_t> state = 0;
+		std::atomic<std::thread::id> owner;
+		Record* next = nullptr;
+		// Used by the owner only
+		size_t pins = 0;
+		size_t retiredSinceCollect = 0;
+		std::vector<Retired> retired;
+		Allocator<Block> allocator;
+		// Memory of the objects of this thread freed by the other ones
+		alignas(CACHE_LINE) std::atomic<Block*> returned = nullptr;
+
+		explicit Record(std::thread::id owner) : owner(owner) {}
+	};
+
+	std::atomic<uint64_t> epoch = 0;
+	std::atomic<Record*> records = nullptr;
+	// Distinguishes the reclaimers in the records cache of the threads (addresses of the destroyed reclaimers are reused)
+	const uint64_t id = nextId.fetch_add(1, std::memory_order_relaxed) + 1;
+
+	static inline std::atomic<uint64_t> nextId = 0;
+
+public:
+	// Pinned section of the calling thread: the objects it reads are not destroyed until the guard is gone.
+	// Sections can be nested, the outermost one announces the epoch
+	class Guard
+	{
+		EpochReclaimer& reclaimer;
+		Record& record;
+
+		friend class EpochReclaimer;
+		Guard(EpochReclaimer& reclaimer, Record& record) : reclaimer(reclaimer), record(record) {}
+
+	public:
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+		// The outermost section frees the retired objects that became safe: a thread retiring a few objects doesn't keep them
+		~Guard() {
+			if (--record.pins == 0) {
+				record.state.store(0, std::memory_order_release);
+				if (!record.retired.empty())
+					reclaimer.collect(record);
+			}
+		}
+	};
+
+	EpochReclaimer() {};
+	EpochReclaimer(const EpochReclaimer&) = delete;
+	EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+	// Destroys all the retired objects. No thread may be pinned
+	~EpochReclaimer();
+
+	Guard pin();
+
+	// Creates the object in the memory of the calling thread's allocator (the memory returned by the other threads goes first)
+	template<typename... Args>
+	T* create(Args&&... args);
+
+	// Destroys the object at once: it must be unreachable for the other threads (never published)
+	void destroy(T* object);
+
+	// Destroys the object when no thread can read it. The object must be already unlinked, the calling thread must be pinned
+	void retire(T* object);
+
+	// Tries to advance the epoch and destroys the objects of the calling thread that became safe
+	void collect() { collect(record()); }
+
+private:
+	Record& record();
+	void collect(Record& record);
+	// Destroys the object and gives its memory back to the allocator of its creator
+	void free(Record& record, T* object);
+	// Moves the memory returned by the other threads to the allocator of the record
+	static void takeReturned(Record& record);
+	// Every pinned thread has announced the epoch
+	bool allAnnounced(uint64_t current) const;
+};
+
+template<typename T, template<typename> class Allocator>
+inline EpochReclaimer<T, Allocator>::~EpochReclaimer()
+{
+	// The memory goes back to the allocators of the creators: all of them are alive until the objects are destroyed
+	for (Record* record = records.load(std::memory_order_acquire); record != nullptr; record = record->next)
+		for (const Retired& retired : record->retired) {
+			Block* block = Block::of(retired.object);
+			retired.object->~T();
+			block->owner->allocator.deallocate(block);
+		}
+	for (Record* record = records.load(std::memory_order_relaxed); record != nullptr; record = record->next)
+		takeReturned(*record);
+	Record* record = records.load(std::memory_order_relaxed);
+	while (record != nullptr) {
+		Record* next = record->next;
+		delete record;
+		record = next;
+	}
+}
+
+template<typename T, template<typename> class Allocator>
+inline EpochReclaimer<T, Allocator>::Record& EpochReclaimer<T, Allocator>::record()
+{
+	// The last reclaimer used by the thread
+	struct Cache {
+		uint64_t reclaimer = 0;
+		Record* record = nullptr;
+	};
+	thread_local Cache cache;
+	if (cache.reclaimer == id)
+		return *cache.record;
+
+	std::thread::id self = std::this_thread::get_id();
+	Record* head = records.load(std::memory_order_acquire);
+	Record* found = nullptr;
+	for (Record* record = head; record != nullptr && found == nullptr; record = record->next)
+		if (record->owner.load(std::memory_order_relaxed) == self)
+			found = record;
+	if (found == nullptr) {
+		found = new Record(self);
+		found->next = head;
+		while (!records.compare_exchange_weak(found->next, found, std::memory_order_release, std::memory_order_acquire));
+	}
+	cache = { id, found };
+	return *found;
+}
+
+template<typename T, template<typename> class Allocator>
+inline EpochReclaimer<T, Allocator>::Guard EpochReclaimer<T, Allocator>::pin()
+{
+	Record& record = this->record();
+	// The announcement is a full barrier: it's visible to the collectors before this thread reads any object
+	if (record.pins++ == 0)
+		record.state.exchange((epoch.load(std::memory_order_seq_cst) << 1) | 1, std::memory_order_seq_cst);
+	return Guard(*this, record);
+}
+
+template<typename T, template<typename> class Allocator>
+template<typename... Args>
+inline T* EpochReclaimer<T, Allocator>::create(Args&&... args)
+{
+	Record& record = this->record();
+	takeReturned(record);
+	Block* block = new (record.allocator.allocate()) Block(&record);
+	try {
+		return new (block->storage) T(std::forward<Args>(args)...);
+	}
+	catch (...) {
+		record.allocator.deallocate(block);
+		throw;
+	}
+}
+
+template<typename T, template<typename> class Allocator>
+inline void EpochReclaimer<T, Allocator>::destroy(T* object)
+{
+	free(record(), object);
+}
+
+template<typename T, template<typename> class Allocator>
+inline void EpochReclaimer<T, Allocator>::retire(T* object)
+{
+	Record& record = this->record();
+	record.retired.push_back({ object, epoch.load(std::memory_order_seq_cst) });
+	if (++record.retiredSinceCollect >= COLLECT_BATCH)
+		collect(record);
+}
+
+template<typename T, template<typename> class Allocator>
+inline bool EpochReclaimer<T, Allocator>::allAnnounced(uint64_t current) const
+{
+	for (Record* record = records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+		uint64_t state = record->state.load(std::memory_order_seq_cst);
+		if ((state & 1) != 0 && (state >> 1) != current)
+			return false;
+	}
+	return true;
+}
+
+template<typename T, template<typename> class Allocator>
+inline void EpochReclaimer<T, Allocator>::collect(Record& record)
+{
+	record.retiredSinceCollect = 0;
+	uint64_t current = epoch.load(std::memory_order_seq_cst);
+	// Another thread can advance it at the same time: the epoch is updated once
+	if (allAnnounced(current) && epoch.compare_exchange_strong(current, current + 1, std::memory_order_seq_cst))
+		current++;
+	// The objects are retired in the order of the epochs
+	size_t safe = 0;
+	while (safe < record.retired.size() && record.retired[safe].epoch + 2 <= current) {
+		free(record, record.retired[safe].object);
+		safe++;
+	}
+	record.retired.erase(record.retired.begin(), record.retired.begin() + safe);
+}
+
+template<typename T, template<typename> class Allocator>
+inline void EpochReclaimer<T, Allocator>::free(Record& record, T* object)
+{
+	Block* block = Block::of(object);
+	object->~T();
+	Record* owner = block->owner;
+	if (owner == &record) {
+		record.allocator.deallocate(block);
+		return;
+	}
+	// Only the owner takes the list, and it takes it whole: the pushes don't suffer from ABA
+	block->next = owner->returned.load(std::memory_order_relaxed);
+	while (!owner->returned.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+template<typename T, template<typename> class Allocator>
+inline void EpochReclaimer<T, Allocator>::takeReturned(Record& record)
+{
+	if (record.returned.load(std::memory_order_relaxed) == nullptr)
+		return;
+	Block* block = record.returned.exchange(nullptr, std::memory_order_acquire);
+	while (block != nullptr) {
+		Block* next = block->next;
+		record.allocator.deallocate(block);
+		block = next;
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+
+// Instrumentation policies of the containers. The container reports the events of its operations:
+//   void begin(Operation);    - the new public operation starts (the last operation counters are reset)
+//   void passNode();          - a node is passed on the way through the tree
+//   void compare();           - two keys are compared (one three-way comparison per passed node)
+//   void rotate();            - a rotation is done while balancing
+//   void allocate();          - a node is created
+//   void deallocate();        - a node is destroyed
+// Every tree keeps its own policy object, so the counters of different trees are independent
+
+// Kinds of the operations counted separately
+enum class Operation {
+	Find,		// find, contains, at, bounds and ranges
+	Insert,		// insert, operator[]
+	Erase,		// erase
+	Bulk,		// copying, bulk construction, clear
+	Count
+};
+
+struct OperationStats {
+	size_t operations = 0;
+	size_t passedNodes = 0;
+	size_t comparisons = 0;
+	size_t rotations = 0;
+	size_t allocations = 0;
+	size_t deallocations = 0;
+};
+
+// Default policy: all the events are empty inline calls, the optimizer removes them completely
+struct NoInstrumentation
+{
+	static constexpr bool enabled = false;
+
+	void begin(Operation) {}
+	void passNode() {}
+	void compare() {}
+	void rotate() {}
+	void allocate() {}
+	void deallocate() {}
+};
+
+// Counts the events of the last operation and the totals for every operation kind.
+// The counters belong to one tree: trees used by different threads don't share anything,
+// but one tree must not be accessed (even read) by several instrumented threads at once
+class OperationCounters
+{
+	OperationStats last;
+	OperationStats totals[(size_t)Operation::Count];
+	Operation current = Operation::Bulk;
+
+	OperationStats& total() { return totals[(size_t)current]; }
+
+public:
+	static constexpr bool enabled = true;
+
+	void begin(Operation operation) {
+		current = operation;
+		last = OperationStats{};
+		last.operations = 1;
+		total().operations++;
+	}
+	void passNode() { last.passedNodes++; total().passedNodes++; }
+	void compare() { last.comparisons++; total().comparisons++; }
+	void rotate() { last.rotations++; total().rotations++; }
+	void allocate() { last.allocations++; total().allocations++; }
+	void deallocate() { last.deallocations++; total().deallocations++; }
+
+	// Counters of the last started operation
+	const OperationStats& lastOperation() const { return last; }
+	// Counters summed over all the operations of the kind
+	const OperationStats& totalOf(Operation operation) const { return totals[(size_t)operation]; }
+	void reset() { *this = OperationCounters{}; }
+};
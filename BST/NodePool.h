@@ -0,0 +1,215 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+// Node allocators for the containers. An allocator provides raw memory for one object:
+//   T* allocate();            - memory for one T (the object is not constructed)
+//   void deallocate(T*);      - returns the memory of one (already destroyed) object
+// and optionally
+//   void release();           - returns all the memory at once (objects must be already destroyed)
+//   void reserve(size_t);     - prepares memory for the next allocations in one block
+//   void share(A& other);     - makes the memory of other allocator jointly owned by both of them
+
+template<typename A>
+concept BulkReleasable = requires(A allocator) {
+	allocator.release();
+};
+
+template<typename A>
+concept Reservable = requires(A allocator, size_t count) {
+	allocator.reserve(count);
+};
+
+// Nodes allocated by one allocator can be passed to another one (split and join of the trees move the nodes between them):
+// the allocator is stateless or it can share its memory
+template<typename A>
+concept Shareable = std::is_empty_v<A> || requires(A allocator, A& other) {
+	allocator.share(other);
+};
+
+// Allocator calling the global new/delete for every node
+template <typename T>
+class HeapAllocator
+{
+public:
+	T* allocate() { return static_cast<T*>(::operator new(sizeof(T))); }
+	void deallocate(T* ptr) { ::operator delete(ptr); }
+};
+
+// Slab allocator. Takes memory from the system in fixed-size chunks and hands it out node by node,
+// so nodes allocated one after another are adjacent in memory. Freed nodes go to an intrusive free list
+// (the pointer to the next free slot is stored in the freed memory itself) and are reused first.
+// release() frees all the chunks in O(chunks) without visiting the nodes.
+// reserve(n) makes the next n allocations come from one contiguous chunk (while the free list is empty).
+// share(other) turns the chunks of other pool into the shared ones owned by both pools: each pool keeps its own
+// free list and allocates from its own chunk, so the pools sharing memory can be used by different threads.
+// Shared chunks are freed when the last of their owners releases them, so one pool can keep alive the memory of the nodes
+// deallocated by the other one.
+template <typename T>
+class NodePool
+{
+public:
+	static constexpr size_t CHUNK_BYTES = 4096;
+
+private:
+	union Slot {
+		Slot* next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	// Chunk header is followed by its slots
+	struct Chunk {
+		Chunk* next;
+	};
+
+	// Chunks list owned by several pools
+	struct SharedChunks {
+		Chunk* chunks;
+		explicit SharedChunks(Chunk* list) : chunks(list) {};
+		SharedChunks(const SharedChunks&) = delete;
+		SharedChunks& operator=(const SharedChunks&) = delete;
+		~SharedChunks() { freeChunks(chunks); };
+	};
+
+	static constexpr size_t ALIGNMENT = alignof(Slot) > alignof(Chunk) ? alignof(Slot) : alignof(Chunk);
+	static constexpr size_t HEADER_BYTES = (sizeof(Chunk) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	static constexpr size_t SLOTS_PER_CHUNK = (CHUNK_BYTES - HEADER_BYTES) / sizeof(Slot) > 0 ? (CHUNK_BYTES - HEADER_BYTES) / sizeof(Slot) : 1;
+
+	Chunk* chunks = nullptr;
+	std::vector<std::shared_ptr<SharedChunks>> sharedChunks;
+	Slot* freeList = nullptr;
+	// Never used slots of the newest chunk: [bump; bumpEnd)
+	Slot* bump = nullptr;
+	Slot* bumpEnd = nullptr;
+
+	void addChunk(size_t capacity);
+	static void freeChunks(Chunk* chunks);
+
+public:
+	NodePool() = default;
+	// Pool owns the memory of the nodes: it can be moved together with them, but not copied
+	NodePool(const NodePool&) = delete;
+	NodePool& operator=(const NodePool&) = delete;
+	NodePool(NodePool&& other) noexcept;
+	NodePool& operator=(NodePool&& other) noexcept;
+	~NodePool();
+
+	T* allocate();
+	void deallocate(T* ptr);
+	// Makes the next count allocations come from one contiguous block
+	void reserve(size_t count);
+	// Makes this pool co-own all the memory of other pool: nodes allocated by other can be deallocated by this one
+	void share(NodePool& other);
+	// Returns all the chunks to the system (shared chunks: when no other pool owns them).
+	// Objects placed in the pool must be already destroyed
+	void release();
+};
+
+template<typename T>
+inline NodePool<T>::NodePool(NodePool&& other) noexcept
+{
+	chunks = std::exchange(other.chunks, nullptr);
+	sharedChunks = std::move(other.sharedChunks);
+	freeList = std::exchange(other.freeList, nullptr);
+	bump = std::exchange(other.bump, nullptr);
+	bumpEnd = std::exchange(other.bumpEnd, nullptr);
+}
+
+template<typename T>
+inline NodePool<T>& NodePool<T>::operator=(NodePool&& other) noexcept
+{
+	if (this != &other) {
+		release();
+		chunks = std::exchange(other.chunks, nullptr);
+		sharedChunks = std::move(other.sharedChunks);
+		freeList = std::exchange(other.freeList, nullptr);
+		bump = std::exchange(other.bump, nullptr);
+		bumpEnd = std::exchange(other.bumpEnd, nullptr);
+	}
+	return *this;
+}
+
+template<typename T>
+inline NodePool<T>::~NodePool()
+{
+	release();
+}
+
+template<typename T>
+inline T* NodePool<T>::allocate()
+{
+	if (freeList != nullptr) {
+		Slot* slot = freeList;
+		freeList = slot->next;
+		return reinterpret_cast<T*>(slot->storage);
+	}
+	if (bump == bumpEnd) addChunk(SLOTS_PER_CHUNK);
+	return reinterpret_cast<T*>((bump++)->storage);
+}
+
+template<typename T>
+inline void NodePool<T>::reserve(size_t count)
+{
+	if ((size_t)(bumpEnd - bump) < count)
+		addChunk(count > SLOTS_PER_CHUNK ? count : SLOTS_PER_CHUNK);
+}
+
+template<typename T>
+inline void NodePool<T>::addChunk(size_t capacity)
+{
+	// The rest of the previous chunk stays unused until release()
+	void* memory = ::operator new(HEADER_BYTES + capacity * sizeof(Slot), std::align_val_t(ALIGNMENT));
+	Chunk* chunk = static_cast<Chunk*>(memory);
+	chunk->next = chunks;
+	chunks = chunk;
+	bump = reinterpret_cast<Slot*>(static_cast<unsigned char*>(memory) + HEADER_BYTES);
+	bumpEnd = bump + capacity;
+}
+
+template<typename T>
+inline void NodePool<T>::deallocate(T* ptr)
+{
+	Slot* slot = reinterpret_cast<Slot*>(ptr);
+	slot->next = freeList;
+	freeList = slot;
+}
+
+template<typename T>
+inline void NodePool<T>::share(NodePool& other)
+{
+	if (this == &other) return;
+	// All the own chunks of other pool become shared, the one it allocates from too. Only the ownership is shared:
+	// other keeps allocating from its chunk, and this pool takes slots from its own free list and chunks only
+	if (other.chunks != nullptr)
+		other.sharedChunks.push_back(std::make_shared<SharedChunks>(std::exchange(other.chunks, nullptr)));
+	for (const std::shared_ptr<SharedChunks>& shared : other.sharedChunks) {
+		if (std::find(sharedChunks.begin(), sharedChunks.end(), shared) == sharedChunks.end())
+			sharedChunks.push_back(shared);
+	}
+}
+
+template<typename T>
+inline void NodePool<T>::freeChunks(Chunk* chunks)
+{
+	while (chunks != nullptr) {
+		Chunk* next = chunks->next;
+		::operator delete(chunks, std::align_val_t(ALIGNMENT));
+		chunks = next;
+	}
+}
+
+template<typename T>
+inline void NodePool<T>::release()
+{
+	freeChunks(chunks);
+	chunks = nullptr;
+	sharedChunks.clear();
+	freeList = nullptr;
+	bump = nullptr;
+	bumpEnd = nullptr;
+}
@@ -0,0 +1,479 @@
+#pragma once
+#include <atomic>
+#include <optional>
+#include <random>
+#include <thread>
+#include <cstdint>
+#include "BinaryTree.h"
+#include "EpochReclaimer.h"
+
+// Concurrent search tree with optimistic lock coupling: writers of different keys work in parallel.
+//
+// Every node has a version word: the lock bit, the obsolete bit (the node is unlinked from the tree) and the counter of its changes.
+// Readers take no locks. They remember the version of a node, read the node and check that the version is still the same.
+// The child's version is taken before the parent's one is checked (hand-over-hand), so the whole path is valid; a failed check
+// restarts the search from the root.
+// Writers search the same way, then lock only the nodes they change: a lock is the CAS of the remembered version, so the locked node
+// is exactly the one that was read. Insert locks the parent of the new leaf, every rotation locks 3 nodes. Nobody waits for a lock
+// holding another one (a failed CAS releases everything and retries), so there are no deadlocks.
+//
+// The tree is a treap: every node gets a random priority and the priorities form a heap (a parent outranks its children).
+// The shape doesn't depend on the keys order (expected depth is ~2 ln n on any input, like the random BST), and insert/erase
+// restructure only O(1) nodes near the key on average. AVL and red-black retracing can rotate up to the root
+// and would lock the whole path. The heap order is relaxed under concurrency: a node stops rising when its parent outranks it,
+// and the parent can be moved away later by another writer. Such nodes only make the paths a little longer, the search order is exact.
+// Erase marks the node deleted first (that's the moment the key disappears for everybody), then rotates it down
+// until it has one child and unlinks it.
+// Values are written once (insert doesn't replace them), so readers copy them without locks.
+// Unlinked nodes can still be read by the searches passing them: every operation pins the epoch reclaimer (see EpochReclaimer.h),
+// and the nodes are freed when no operation that could see them is running.
+// Allocator provides the memory of the nodes for every thread separately (see NodePool.h)
+template <Comparable K, CopyConstructible V, template<typename> class Allocator = NodePool>
+class OptimisticBinaryTree
+{
+	// Bits of the version word; the rest is the counter of the changes
+	static constexpr uint64_t OBSOLETE = 1;
+	static constexpr uint64_t LOCKED = 2;
+
+	struct Node;
+
+	// Versioned part of the nodes. The header is a link without a key: its left child is the root
+	struct Link {
+		std::atomic<uint64_t> version = 0;
+		std::atomic<Node*> left = nullptr;
+		std::atomic<Node*> right = nullptr;
+	};
+
+	struct Node : Link {
+		const K key;
+		const V value;
+		const uint32_t priority;
+		// Deleted nodes are absent for the searches, while erase is moving them out of the tree
+		std::atomic<bool> deleted = false;
+		// Written under the lock of the current parent. Writers check it by the children of the parent, readers don't use it
+		std::atomic<Link*> parent = nullptr;
+
+		Node(const K& key, const V& value, uint32_t priority) : key(key), value(value), priority(priority) {}
+	};
+
+	// Node with the key (nullptr if there is no such key) and its parent; the versions are the ones the search has checked
+	struct Position {
+		Link* parent;
+		uint64_t parentVersion;
+		Node* node;
+		uint64_t nodeVersion;
+	};
+
+	// Destroyed after the nodes of the tree
+	mutable EpochReclaimer<Node, Allocator> reclaimer;
+	Link header;
+	std::atomic<size_t> count = 0;
+
+public:
+	/*==========================================
+	                CONSTRUCTION
+	==========================================*/
+
+	OptimisticBinaryTree() {};
+	OptimisticBinaryTree(const OptimisticBinaryTree&) = delete;
+	OptimisticBinaryTree& operator=(const OptimisticBinaryTree&) = delete;
+	// No operation may run concurrently with the destructor
+	~OptimisticBinaryTree();
+
+	/*==========================================
+	              READING (NO LOCKS)
+	==========================================*/
+
+	bool contains(const K& key) const;
+
+	// Returns the copy of the value or nothing if tree doesn't contain the provided key
+	std::optional<V> find(const K& key) const;
+
+	V get_or(const K& key, const V& defaultValue) const {
+		std::optional<V> value = find(key);
+		return value.has_value() ? *value : defaultValue;
+	}
+
+	// Exact when no modification is running
+	size_t size() const { return count.load(std::memory_order_relaxed); }
+	bool empty() const { return size() == 0; }
+
+	/*==========================================
+	        MODIFYING (LOCKS A FEW NODES)
+	==========================================*/
+
+	// Inserts the new key:value pair. Returns false if tree already contains the key.
+	// Waits if the node of the key is being erased at this moment
+	bool insert(const K& key, const V& value);
+
+	bool erase(const K& key);
+
+	// Detaches all the nodes at once and retires them in one walk: O(n).
+	// Lookups may run concurrently with clear, modifications may not: a writer holding a node of the detached tree
+	// would change that tree instead of the empty one (its new node would be lost and the size would be wrong)
+	void clear();
+
+private:
+	/*==========================================
+	                 VERSIONS
+	==========================================*/
+
+	// Takes the version of the unlocked link (waits while it's locked). Returns false if the link is obsolete
+	static bool readLock(const Link* link, uint64_t& version) {
+		version = link->version.load(std::memory_order_acquire);
+		while (version & LOCKED) {
+			std::this_thread::yield();
+			version = link->version.load(std::memory_order_acquire);
+		}
+		return (version & OBSOLETE) == 0;
+	}
+
+	// Checks that the link didn't change since its version was taken. The fields are read by the acquire loads,
+	// so this load can't be done before them
+	static bool validate(const Link* link, uint64_t version) {
+		return link->version.load(std::memory_order_acquire) == version;
+	}
+
+	// Locks the link if it didn't change since its version was taken
+	static bool tryLock(Link* link, uint64_t version) {
+		return link->version.compare_exchange_strong(version, version + LOCKED, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	// Adding LOCKED to the locked version clears the bit and increments the counter
+	static void unlock(Link* link) {
+		link->version.fetch_add(LOCKED, std::memory_order_release);
+	}
+
+	static void unlockObsolete(Link* link) {
+		link->version.fetch_add(LOCKED + OBSOLETE, std::memory_order_release);
+	}
+
+	// Unlocks the link that wasn't changed: the readers don't restart
+	static void unlockUnchanged(Link* link, uint64_t version) {
+		link->version.store(version, std::memory_order_release);
+	}
+
+	// Locks the 3 links top-down. On failure nothing stays locked
+	static bool tryLock(Link* top, uint64_t topVersion, Link* middle, uint64_t middleVersion, Link* bottom, uint64_t bottomVersion) {
+		if (!tryLock(top, topVersion))
+			return false;
+		if (!tryLock(middle, middleVersion)) {
+			unlockUnchanged(top, topVersion);
+			return false;
+		}
+		if (!tryLock(bottom, bottomVersion)) {
+			unlockUnchanged(middle, middleVersion);
+			unlockUnchanged(top, topVersion);
+			return false;
+		}
+		return true;
+	}
+
+	/*==========================================
+	                STRUCTURE
+	==========================================*/
+
+	static bool isChild(const Link* parent, const Node* node) {
+		return parent->left.load(std::memory_order_acquire) == node || parent->right.load(std::memory_order_acquire) == node;
+	}
+
+	// Pointer of the parent to its child (the link must be locked)
+	static std::atomic<Node*>& childSlot(Link* parent, const Node* child) {
+		return parent->left.load(std::memory_order_relaxed) == child ? parent->left : parent->right;
+	}
+
+	// Pointer of the parent where the key belongs
+	std::atomic<Node*>& keySlot(Link* parent, const K& key) {
+		if (parent == &header)
+			return header.left;
+		return key < static_cast<Node*>(parent)->key ? parent->left : parent->right;
+	}
+
+	// Moves the node above its parent. All 3 links must be locked
+	static void rotateUp(Link* grand, Node* parent, Node* node);
+
+	static uint32_t randomPriority() {
+		thread_local std::minstd_rand random(std::random_device{}());
+		return (uint32_t)random();
+	}
+
+	// Returns false if the search met a change and must restart
+	bool search(const K& key, Position& position) const;
+	// Rotates the new node up while it outranks its parent
+	void siftUp(Node* node);
+	// Rotates the deleted node down while it has two children, then replaces it by its child
+	void unlink(Node* node);
+	// Passes every node of the detached subtree to release(Node*); the children of a node are taken before it is released
+	template<typename Release>
+	static void releaseSubtree(Node* root, Release&& release);
+};
+
+/*==========================================================================================
+
+								  READING
+
+===========================================================================================*/
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline bool OptimisticBinaryTree<K, V, Allocator>::search(const K& key, Position& position) const
+{
+	const Link* parent = &header;
+	uint64_t parentVersion;
+	readLock(parent, parentVersion);
+	Node* node = header.left.load(std::memory_order_acquire);
+	while (node != nullptr) {
+		uint64_t version;
+		// The node was the child of the parent when its version was taken
+		if (!readLock(node, version) || !validate(parent, parentVersion))
+			return false;
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0) {
+			position = { const_cast<Link*>(parent), parentVersion, node, version };
+			return true;
+		}
+		Node* child = (order < 0 ? node->left : node->right).load(std::memory_order_acquire);
+		parent = node;
+		parentVersion = version;
+		node = child;
+	}
+	if (!validate(parent, parentVersion))
+		return false;
+	position = { const_cast<Link*>(parent), parentVersion, nullptr, 0 };
+	return true;
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline bool OptimisticBinaryTree<K, V, Allocator>::contains(const K& key) const
+{
+	auto guard = reclaimer.pin();
+	while (true) {
+		Position position;
+		if (!search(key, position))
+			continue;
+		if (position.node == nullptr)
+			return false;
+		bool deleted = position.node->deleted.load(std::memory_order_acquire);
+		if (validate(position.node, position.nodeVersion))
+			return !deleted;
+	}
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline std::optional<V> OptimisticBinaryTree<K, V, Allocator>::find(const K& key) const
+{
+	auto guard = reclaimer.pin();
+	while (true) {
+		Position position;
+		if (!search(key, position))
+			continue;
+		if (position.node == nullptr)
+			return std::nullopt;
+		bool deleted = position.node->deleted.load(std::memory_order_acquire);
+		if (!validate(position.node, position.nodeVersion))
+			continue;
+		// The value never changes: it's read after the check
+		return deleted ? std::nullopt : std::optional<V>(position.node->value);
+	}
+}
+
+/*==========================================================================================
+
+								  MODIFYING
+
+===========================================================================================*/
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline bool OptimisticBinaryTree<K, V, Allocator>::insert(const K& key, const V& value)
+{
+	auto guard = reclaimer.pin();
+	// Created once, when the first free place is found
+	Node* node = nullptr;
+	while (true) {
+		Position position;
+		if (!search(key, position))
+			continue;
+		if (position.node != nullptr) {
+			bool deleted = position.node->deleted.load(std::memory_order_acquire);
+			if (!validate(position.node, position.nodeVersion))
+				continue;
+			if (!deleted) {
+				if (node != nullptr)
+					reclaimer.destroy(node);
+				return false;
+			}
+			// The key is erased, but its node is still in the tree: erase is about to unlink it
+			std::this_thread::yield();
+			continue;
+		}
+		if (node == nullptr)
+			node = reclaimer.create(key, value, randomPriority());
+		node->parent.store(position.parent, std::memory_order_relaxed);
+		// The free place is still free if the parent didn't change
+		if (!tryLock(position.parent, position.parentVersion))
+			continue;
+		keySlot(position.parent, key).store(node, std::memory_order_release);
+		unlock(position.parent);
+		count.fetch_add(1, std::memory_order_relaxed);
+		siftUp(node);
+		return true;
+	}
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline bool OptimisticBinaryTree<K, V, Allocator>::erase(const K& key)
+{
+	auto guard = reclaimer.pin();
+	Node* node;
+	while (true) {
+		Position position;
+		if (!search(key, position))
+			continue;
+		if (position.node == nullptr)
+			return false;
+		node = position.node;
+		if (!tryLock(node, position.nodeVersion))
+			continue;
+		if (node->deleted.load(std::memory_order_relaxed)) {
+			unlockUnchanged(node, position.nodeVersion);
+			return false;
+		}
+		node->deleted.store(true, std::memory_order_release);
+		unlock(node);
+		break;
+	}
+	count.fetch_sub(1, std::memory_order_relaxed);
+	unlink(node);
+	return true;
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline void OptimisticBinaryTree<K, V, Allocator>::rotateUp(Link* grand, Node* parent, Node* node)
+{
+	// The inner subtree of the node changes its parent
+	Node* inner;
+	if (parent->left.load(std::memory_order_relaxed) == node) {
+		inner = node->right.load(std::memory_order_relaxed);
+		parent->left.store(inner, std::memory_order_release);
+		node->right.store(parent, std::memory_order_release);
+	}
+	else {
+		inner = node->left.load(std::memory_order_relaxed);
+		parent->right.store(inner, std::memory_order_release);
+		node->left.store(parent, std::memory_order_release);
+	}
+	if (inner != nullptr)
+		inner->parent.store(parent, std::memory_order_release);
+	childSlot(grand, parent).store(node, std::memory_order_release);
+	parent->parent.store(node, std::memory_order_release);
+	node->parent.store(grand, std::memory_order_release);
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline void OptimisticBinaryTree<K, V, Allocator>::siftUp(Node* node)
+{
+	while (true) {
+		uint64_t nodeVersion;
+		// Erase of the node has taken it over
+		if (!readLock(node, nodeVersion) || node->deleted.load(std::memory_order_acquire))
+			return;
+		Link* parentLink = node->parent.load(std::memory_order_acquire);
+		if (parentLink == &header)
+			return;
+		Node* parent = static_cast<Node*>(parentLink);
+		uint64_t parentVersion;
+		// The parent pointer is a hint: it's right if the parent has the node as a child
+		if (!readLock(parent, parentVersion) || !isChild(parent, node) || !validate(node, nodeVersion))
+			continue;
+		if (node->priority <= parent->priority)
+			return;
+		Link* grand = parent->parent.load(std::memory_order_acquire);
+		uint64_t grandVersion;
+		if (!readLock(grand, grandVersion) || !isChild(grand, parent) || !validate(parent, parentVersion))
+			continue;
+		if (!tryLock(grand, grandVersion, parent, parentVersion, node, nodeVersion))
+			continue;
+		rotateUp(grand, parent, node);
+		unlock(node);
+		unlock(parent);
+		unlock(grand);
+	}
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline void OptimisticBinaryTree<K, V, Allocator>::unlink(Node* node)
+{
+	while (true) {
+		// Only this thread can make the node obsolete
+		uint64_t nodeVersion;
+		readLock(node, nodeVersion);
+		Link* parent = node->parent.load(std::memory_order_acquire);
+		uint64_t parentVersion;
+		if (!readLock(parent, parentVersion) || !isChild(parent, node) || !validate(node, nodeVersion))
+			continue;
+		Node* left = node->left.load(std::memory_order_acquire);
+		Node* right = node->right.load(std::memory_order_acquire);
+		if (left != nullptr && right != nullptr) {
+			// The child with the higher priority goes up, so the heap order stays below it
+			Node* child = left->priority > right->priority ? left : right;
+			uint64_t childVersion;
+			if (!readLock(child, childVersion) || !validate(node, nodeVersion))
+				continue;
+			if (!tryLock(parent, parentVersion, node, nodeVersion, child, childVersion))
+				continue;
+			rotateUp(parent, node, child);
+			unlock(child);
+			unlock(node);
+			unlock(parent);
+			continue;
+		}
+		if (!tryLock(parent, parentVersion))
+			continue;
+		if (!tryLock(node, nodeVersion)) {
+			unlockUnchanged(parent, parentVersion);
+			continue;
+		}
+		// The only child (if any) keeps its subtree: it's not locked, its parent pointer is guarded by the locked parents
+		Node* child = left != nullptr ? left : right;
+		childSlot(parent, node).store(child, std::memory_order_release);
+		if (child != nullptr)
+			child->parent.store(parent, std::memory_order_release);
+		unlock(parent);
+		unlockObsolete(node);
+		reclaimer.retire(node);
+		return;
+	}
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+template<typename Release>
+inline void OptimisticBinaryTree<K, V, Allocator>::releaseSubtree(Node* root, Release&& release)
+{
+	std::vector<Node*> stack;
+	if (root != nullptr)
+		stack.push_back(root);
+	while (!stack.empty()) {
+		Node* node = stack.back();
+		stack.pop_back();
+		if (Node* left = node->left.load(std::memory_order_relaxed))
+			stack.push_back(left);
+		if (Node* right = node->right.load(std::memory_order_relaxed))
+			stack.push_back(right);
+		release(node);
+	}
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline void OptimisticBinaryTree<K, V, Allocator>::clear()
+{
+	// The nodes go through the reclaimer: the concurrent lookups can still be reading the detached tree
+	auto guard = reclaimer.pin();
+	Node* root = header.left.exchange(nullptr, std::memory_order_acq_rel);
+	count.store(0, std::memory_order_relaxed);
+	releaseSubtree(root, [&](Node* node) { reclaimer.retire(node); });
+}
+
+template <Comparable K, CopyConstructible V, template<typename> class Allocator>
+inline OptimisticBinaryTree<K, V, Allocator>::~OptimisticBinaryTree()
+{
+	releaseSubtree(header.left.load(std::memory_order_relaxed), [&](Node* node) { reclaimer.destroy(node); });
+}
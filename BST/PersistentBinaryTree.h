@@ -0,0 +1,457 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <iterator>
+#include <cstddef>
+#include "BinaryTree.h"
+
+// Persistent (immutable) AVL tree: every version of the tree stays readable while the next ones are built.
+//
+// Nodes never change after their creation. Insert and erase copy only the path from the root to the changed key
+// (O(log n) nodes, the rotations of the rebalancing create their nodes too); the rest of the nodes is shared with the previous version.
+// Nodes are reference counted: a node is destroyed when no version refers to it. The counters are atomic,
+// so the versions can be read and released by any threads while the tree is modified.
+//
+// PersistentSnapshot is a read-only version: copying it is O(1) (one more reference to the root).
+// PersistentBinaryTree is the modifiable current version: snapshot() returns its state in O(1),
+// and a long scan of the snapshot neither blocks the writer nor copies the tree.
+// One tree object is modified by one thread at a time (like BinaryTree); to share the versions with the readers,
+// take the snapshot under the same lock as the modifications and read it without any lock.
+// Binary trees with the parent links (BinaryTree) can't share the nodes between versions: a node would have several parents
+
+template <Comparable K, CopyConstructible V>
+class PersistentSnapshot
+{
+public:
+	class const_iterator;
+
+protected:
+	struct Node;
+
+	// Owning reference to a node. Copies share the node
+	class NodeRef {
+		const Node* node = nullptr;
+
+	public:
+		NodeRef() = default;
+		// Takes over the reference of the new node
+		explicit NodeRef(const Node* node) : node(node) {};
+		NodeRef(const NodeRef& other) : node(other.node) {
+			if (node != nullptr)
+				node->references.fetch_add(1, std::memory_order_relaxed);
+		};
+		NodeRef(NodeRef&& other) noexcept : node(std::exchange(other.node, nullptr)) {};
+		NodeRef& operator=(NodeRef other) noexcept {
+			std::swap(node, other.node);
+			return *this;
+		};
+		// The last owner destroys the node (and releases its children)
+		~NodeRef() {
+			if (node != nullptr && node->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete node;
+		};
+
+		const Node* get() const { return node; };
+		const Node* operator->() const { return node; };
+		explicit operator bool() const { return node != nullptr; };
+	};
+
+	struct Node {
+		const K key;
+		const V value;
+		const NodeRef left;
+		const NodeRef right;
+		// Height of the subtree (leaf is 1)
+		const unsigned char height;
+		mutable std::atomic<size_t> references = 1;
+
+		Node(const K& key, const V& value, NodeRef left, NodeRef right, unsigned char height)
+			: key(key), value(value), left(std::move(left)), right(std::move(right)), height(height) {};
+	};
+
+	NodeRef root;
+	size_t size_ = 0;
+
+	// Search core of contains, at, try_get and get_or
+	const Node* findNode(const K& key) const;
+
+public:
+	/*==========================================
+	                CONSTRUCTION
+	==========================================*/
+
+	PersistentSnapshot() {};
+	// Copies share all the nodes: O(1)
+	PersistentSnapshot(const PersistentSnapshot&) = default;
+	PersistentSnapshot(PersistentSnapshot&& other) noexcept : root(std::move(other.root)), size_(std::exchange(other.size_, 0)) {};
+	PersistentSnapshot& operator=(const PersistentSnapshot&) = default;
+	PersistentSnapshot& operator=(PersistentSnapshot&& other) noexcept {
+		root = std::move(other.root);
+		size_ = std::exchange(other.size_, 0);
+		return *this;
+	};
+
+	/*==========================================
+	                  READING
+	==========================================*/
+
+	size_t size() const { return size_; };
+	bool empty() const { return size_ == 0; };
+	bool contains(const K& key) const { return findNode(key) != nullptr; };
+
+	// Throws out_of_range exception if tree doesn't contain the provided key
+	const V& at(const K& key) const;
+	// Non-throwing access: returns the pointer to the value or nullptr if tree doesn't contain the provided key
+	const V* try_get(const K& key) const;
+	// Returns the copy of the value or defaultValue if tree doesn't contain the provided key
+	V get_or(const K& key, const V& defaultValue) const;
+
+	// In order pass. Transfers every element into the callable
+	template<std::invocable<const K&, const V&> Func>
+	void forEach(Func&& func) const;
+	std::vector<std::pair<K, V>> items() const;
+
+	/*==========================================
+	                 ITERATORS
+	==========================================*/
+
+	// Forward iterator over the elements in the keys order. The nodes have no parent links: the iterator keeps
+	// the nodes still to be visited on the way up (O(log n) pointers). It stays valid while the version it came from is alive
+	class const_iterator {
+		friend class PersistentSnapshot;
+		std::vector<const Node*> path;
+
+		// Goes to the smallest key of the subtree
+		void descendLeft(const Node* node) {
+			for (; node != nullptr; node = node->left.get())
+				path.push_back(node);
+		};
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::pair<const K&, const V&>;
+		using difference_type = std::ptrdiff_t;
+
+		const_iterator() = default;
+		std::pair<const K&, const V&> operator*() const {
+			if (path.empty()) throw std::logic_error("Iterator operation *: can't get the value of the end node");
+			return std::pair<const K&, const V&>(path.back()->key, path.back()->value);
+		};
+		const_iterator& operator++() {
+			if (path.empty()) throw std::logic_error("Iterator operation ++: can't go forward from the end node");
+			const Node* node = path.back();
+			path.pop_back();
+			descendLeft(node->right.get());
+			return *this;
+		};
+		const_iterator operator++(int) { const_iterator previous = *this; ++*this; return previous; };
+		friend bool operator==(const const_iterator& one, const const_iterator& two) {
+			if (one.path.empty() || two.path.empty())
+				return one.path.empty() == two.path.empty();
+			return one.path.back() == two.path.back();
+		};
+	};
+
+	const_iterator begin() const;
+	const_iterator end() const { return const_iterator(); };
+	// The first element with the key not before (lower_bound) or after (upper_bound) the provided one: O(log n)
+	const_iterator lower_bound(const K& key) const { return bound(key, false); };
+	const_iterator upper_bound(const K& key) const { return bound(key, true); };
+
+private:
+	const_iterator bound(const K& key, bool strict) const;
+};
+
+template <Comparable K, CopyConstructible V>
+class PersistentBinaryTree : public PersistentSnapshot<K, V>
+{
+	using Snapshot = PersistentSnapshot<K, V>;
+	using typename Snapshot::Node;
+	using typename Snapshot::NodeRef;
+
+public:
+	/*==========================================
+	                CONSTRUCTION
+	==========================================*/
+
+	PersistentBinaryTree() {};
+	// Continues the version of the snapshot: the nodes stay shared
+	explicit PersistentBinaryTree(const Snapshot& snapshot) : Snapshot(snapshot) {};
+
+	// Current version of the tree: O(1), later modifications of the tree don't change it
+	Snapshot snapshot() const { return *this; };
+
+	/*==========================================
+	                 MODIFYING
+	==========================================*/
+
+	// Each modification creates O(log n) nodes and releases the ones the other versions don't share.
+	// The iterators of the tree are invalidated; the snapshots are not affected.
+	// On exception the tree stays unchanged
+
+	// Inserts the new key:value pair. Returns false if tree already contains the key
+	bool insert(const K& key, const V& value);
+	// Inserts the pair or replaces the value of the existing key. Returns true if the key is new
+	bool insert_or_assign(const K& key, const V& value);
+	bool erase(const K& key);
+	void clear();
+
+private:
+	static unsigned char heightOf(const Node* node) { return node != nullptr ? node->height : 0; };
+	static NodeRef makeNode(const K& key, const V& value, NodeRef left, NodeRef right);
+	// Creates the node over the subtrees differing in height at most by 2, rotating to restore the AVL balance
+	static NodeRef balance(const K& key, const V& value, NodeRef left, NodeRef right);
+
+	// Builds the new version of the subtree with the key. Returns false if the subtree doesn't change
+	// (the key is there and assign is false); added is set if the key is new
+	static bool insertInto(const Node* node, const K& key, const V& value, bool assign, NodeRef& result, bool& added);
+	// Builds the new version of the subtree without the key. Returns false if there is no such key
+	static bool eraseFrom(const Node* node, const K& key, NodeRef& result);
+	// New version of the (non-empty) subtree without its smallest node
+	static NodeRef eraseMin(const Node* node, const Node*& min);
+};
+
+/*==========================================================================================
+
+								  READING
+
+===========================================================================================*/
+
+template <Comparable K, CopyConstructible V>
+inline const PersistentSnapshot<K, V>::Node* PersistentSnapshot<K, V>::findNode(const K& key) const
+{
+	const Node* node = root.get();
+	while (node != nullptr) {
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0)
+			return node;
+		node = order < 0 ? node->left.get() : node->right.get();
+	}
+	return nullptr;
+}
+
+template <Comparable K, CopyConstructible V>
+inline const V& PersistentSnapshot<K, V>::at(const K& key) const
+{
+	const Node* node = findNode(key);
+	if (node == nullptr) throw std::out_of_range("operation at: no such key in the tree");
+	return node->value;
+}
+
+template <Comparable K, CopyConstructible V>
+inline const V* PersistentSnapshot<K, V>::try_get(const K& key) const
+{
+	const Node* node = findNode(key);
+	return node != nullptr ? &node->value : nullptr;
+}
+
+template <Comparable K, CopyConstructible V>
+inline V PersistentSnapshot<K, V>::get_or(const K& key, const V& defaultValue) const
+{
+	const Node* node = findNode(key);
+	return node != nullptr ? node->value : defaultValue;
+}
+
+template <Comparable K, CopyConstructible V>
+template<std::invocable<const K&, const V&> Func>
+inline void PersistentSnapshot<K, V>::forEach(Func&& func) const
+{
+	for (const_iterator it = begin(); it != end(); ++it) {
+		const Node* node = it.path.back();
+		func(node->key, node->value);
+	}
+}
+
+template <Comparable K, CopyConstructible V>
+inline std::vector<std::pair<K, V>> PersistentSnapshot<K, V>::items() const
+{
+	std::vector<std::pair<K, V>> items;
+	items.reserve(size_);
+	forEach([&](const K& key, const V& value) { items.emplace_back(key, value); });
+	return items;
+}
+
+template <Comparable K, CopyConstructible V>
+inline PersistentSnapshot<K, V>::const_iterator PersistentSnapshot<K, V>::begin() const
+{
+	const_iterator it;
+	it.descendLeft(root.get());
+	return it;
+}
+
+template <Comparable K, CopyConstructible V>
+inline PersistentSnapshot<K, V>::const_iterator PersistentSnapshot<K, V>::bound(const K& key, bool strict) const
+{
+	// The nodes passed on the way to the left are the ones after the key: they are visited next
+	const_iterator it;
+	const Node* node = root.get();
+	while (node != nullptr) {
+		std::strong_ordering order = key <=> node->key;
+		if (order == 0 && !strict) {
+			it.path.push_back(node);
+			break;
+		}
+		if (order < 0) {
+			it.path.push_back(node);
+			node = node->left.get();
+		}
+		else
+			node = node->right.get();
+	}
+	return it;
+}
+
+/*==========================================================================================
+
+								  MODIFYING
+
+===========================================================================================*/
+
+template <Comparable K, CopyConstructible V>
+inline bool PersistentBinaryTree<K, V>::insert(const K& key, const V& value)
+{
+	NodeRef result;
+	bool added = false;
+	if (!insertInto(this->root.get(), key, value, false, result, added))
+		return false;
+	this->root = std::move(result);
+	this->size_++;
+	return true;
+}
+
+template <Comparable K, CopyConstructible V>
+inline bool PersistentBinaryTree<K, V>::insert_or_assign(const K& key, const V& value)
+{
+	NodeRef result;
+	bool added = false;
+	insertInto(this->root.get(), key, value, true, result, added);
+	this->root = std::move(result);
+	if (added)
+		this->size_++;
+	return added;
+}
+
+template <Comparable K, CopyConstructible V>
+inline bool PersistentBinaryTree<K, V>::erase(const K& key)
+{
+	NodeRef result;
+	if (!eraseFrom(this->root.get(), key, result))
+		return false;
+	this->root = std::move(result);
+	this->size_--;
+	return true;
+}
+
+template <Comparable K, CopyConstructible V>
+inline void PersistentBinaryTree<K, V>::clear()
+{
+	this->root = NodeRef();
+	this->size_ = 0;
+}
+
+template <Comparable K, CopyConstructible V>
+inline PersistentBinaryTree<K, V>::NodeRef PersistentBinaryTree<K, V>::makeNode(const K& key, const V& value, NodeRef left, NodeRef right)
+{
+	unsigned char height = 1 + std::max(heightOf(left.get()), heightOf(right.get()));
+	return NodeRef(new Node(key, value, std::move(left), std::move(right), height));
+}
+
+template <Comparable K, CopyConstructible V>
+inline PersistentBinaryTree<K, V>::NodeRef PersistentBinaryTree<K, V>::balance(const K& key, const V& value, NodeRef left, NodeRef right)
+{
+	// The shared nodes can't be rotated: the rotated ones are created anew
+	if (heightOf(left.get()) > heightOf(right.get()) + 1) {
+		const Node* pivot = left.get();
+		if (heightOf(pivot->left.get()) >= heightOf(pivot->right.get()))
+			return makeNode(pivot->key, pivot->value, pivot->left, makeNode(key, value, pivot->right, std::move(right)));
+		const Node* inner = pivot->right.get();
+		return makeNode(inner->key, inner->value,
+			makeNode(pivot->key, pivot->value, pivot->left, inner->left),
+			makeNode(key, value, inner->right, std::move(right)));
+	}
+	if (heightOf(right.get()) > heightOf(left.get()) + 1) {
+		const Node* pivot = right.get();
+		if (heightOf(pivot->right.get()) >= heightOf(pivot->left.get()))
+			return makeNode(pivot->key, pivot->value, makeNode(key, value, std::move(left), pivot->left), pivot->right);
+		const Node* inner = pivot->left.get();
+		return makeNode(inner->key, inner->value,
+			makeNode(key, value, std::move(left), inner->left),
+			makeNode(pivot->key, pivot->value, inner->right, pivot->right));
+	}
+	return makeNode(key, value, std::move(left), std::move(right));
+}
+
+template <Comparable K, CopyConstructible V>
+inline bool PersistentBinaryTree<K, V>::insertInto(const Node* node, const K& key, const V& value, bool assign, NodeRef& result, bool& added)
+{
+	// Recursion depth is the height of the AVL tree: O(log n)
+	if (node == nullptr) {
+		result = makeNode(key, value, NodeRef(), NodeRef());
+		added = true;
+		return true;
+	}
+	std::strong_ordering order = key <=> node->key;
+	if (order == 0) {
+		if (!assign)
+			return false;
+		result = makeNode(node->key, value, node->left, node->right);
+		return true;
+	}
+	NodeRef child;
+	if (order < 0) {
+		if (!insertInto(node->left.get(), key, value, assign, child, added))
+			return false;
+		result = balance(node->key, node->value, std::move(child), node->right);
+	}
+	else {
+		if (!insertInto(node->right.get(), key, value, assign, child, added))
+			return false;
+		result = balance(node->key, node->value, node->left, std::move(child));
+	}
+	return true;
+}
+
+template <Comparable K, CopyConstructible V>
+inline bool PersistentBinaryTree<K, V>::eraseFrom(const Node* node, const K& key, NodeRef& result)
+{
+	if (node == nullptr)
+		return false;
+	std::strong_ordering order = key <=> node->key;
+	if (order == 0) {
+		if (!node->left)
+			result = node->right;
+		else if (!node->right)
+			result = node->left;
+		else {
+			// The successor takes the place of the node. It stays alive: the previous version refers to it
+			const Node* min = nullptr;
+			NodeRef right = eraseMin(node->right.get(), min);
+			result = balance(min->key, min->value, node->left, std::move(right));
+		}
+		return true;
+	}
+	NodeRef child;
+	if (order < 0) {
+		if (!eraseFrom(node->left.get(), key, child))
+			return false;
+		result = balance(node->key, node->value, std::move(child), node->right);
+	}
+	else {
+		if (!eraseFrom(node->right.get(), key, child))
+			return false;
+		result = balance(node->key, node->value, node->left, std::move(child));
+	}
+	return true;
+}
+
+template <Comparable K, CopyConstructible V>
+inline PersistentBinaryTree<K, V>::NodeRef PersistentBinaryTree<K, V>::eraseMin(const Node* node, const Node*& min)
+{
+	if (!node->left) {
+		min = node;
+		return node->right;
+	}
+	return balance(node->key, node->value, eraseMin(node->left.get(), min), node->right);
+}
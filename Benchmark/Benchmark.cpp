@@ -0,0 +1,774 @@
+// Benchmark.cpp : standalone benchmark of BinaryTree against std::map.
+//
+// Build on Linux (the project doesn't need Windows headers):
+//   g++ -std=c++20 -O2 -DNDEBUG -pthread -I../BST Benchmark.cpp -o benchmark
+// On Windows it's the Benchmark project of L2_BST.sln.
+//
+// Usage:
+//   benchmark [--workload rand|ord|mixed] [--n N] [--ops M] [--seed S]
+//             [--find P] [--insert P] [--erase P] [--containers none,avl,rb,map]
+//             [--format text|csv|json]
+//   benchmark --threads 1,2,4,8,16 [--workload rand|prodcons] [--n N] [--ops M] [--seed S] [--containers olc,locked]
+//             [--format text|csv|json]
+//
+// Workloads:
+//   rand  - test_rand of BST.cpp: n random keys, then n/2 rounds of erase, insert and lookup, 10% of the rounds miss
+//   ord   - test_ord of BST.cpp: n sorted keys, then n/2 rounds of missing erase, existing insert and missing lookup
+//           (the unbalanced tree degenerates into a list here: O(n^2) total, keep n small for "none")
+//   mixed - n random keys from [0; 2n), then --ops operations with the given percentages of find/insert/erase
+// The operations stream is generated once from the seed and replayed on every container, so the runs are reproducible.
+//
+// Reported for every container and operation kind: ns/op percentiles, mean, ops/sec. Every operation is timed
+// separately, so the numbers include the clock reading (tens of nanoseconds).
+// Memory: bytes per element (heap bytes requested by the filled container / its size: the mixed filling can repeat keys)
+// and the growth of the resident memory from the creation of the container to the end of the filling.
+//
+// Multi-threaded mode (--threads): the rounds of the rand workload run in parallel on the concurrent containers,
+// see THREADS below. Reported for every container and number of threads: operations, seconds, ops/sec,
+// the speedup against the first number of threads in the list and the bytes per element after the filling and at the end.
+// The prodcons workload runs pairs of threads: one inserts the keys, the other erases them (see runProducerConsumer);
+// the process fails if the memory per element at the end is more than MEMORY_GROWTH_LIMIT times the one after the filling.
+
+#include "BinaryTree.h"
+#include <map>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "ConcurrentBinaryTree.h"
+#include "OptimisticBinaryTree.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+
+typedef unsigned long long INT_64;
+
+/*==========================================================================================
+
+								  HEAP ACCOUNTING
+
+===========================================================================================*/
+
+// Global new/delete are replaced to know how many bytes the containers request from the heap.
+// Every block keeps a header with the malloc'ed pointer and the requested size right before the user memory.
+// The counter is atomic: the threads of the multi-threaded mode allocate at once
+namespace heap {
+	struct Header {
+		void* raw;
+		size_t size;
+	};
+	std::atomic<size_t> liveBytes = 0;
+
+	void* allocate(size_t size, size_t alignment)
+	{
+		if (alignment < alignof(Header)) alignment = alignof(Header);
+		void* raw = std::malloc(size + alignment + sizeof(Header));
+		if (raw == nullptr) throw std::bad_alloc();
+		uintptr_t user = ((uintptr_t)raw + sizeof(Header) + alignment - 1) / alignment * alignment;
+		Header* header = reinterpret_cast<Header*>(user) - 1;
+		header->raw = raw;
+		header->size = size;
+		liveBytes.fetch_add(size, std::memory_order_relaxed);
+		return reinterpret_cast<void*>(user);
+	}
+
+	void deallocate(void* memory)
+	{
+		if (memory == nullptr) return;
+		Header* header = static_cast<Header*>(memory) - 1;
+		liveBytes.fetch_sub(header->size, std::memory_order_relaxed);
+		std::free(header->raw);
+	}
+}
+
+void* operator new(size_t size) { return heap::allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size) { return heap::allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t alignment) { return heap::allocate(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return heap::allocate(size, (size_t)alignment); }
+void operator delete(void* memory) noexcept { heap::deallocate(memory); }
+void operator delete[](void* memory) noexcept { heap::deallocate(memory); }
+void operator delete(void* memory, size_t) noexcept { heap::deallocate(memory); }
+void operator delete[](void* memory, size_t) noexcept { heap::deallocate(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { heap::deallocate(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { heap::deallocate(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { heap::deallocate(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { heap::deallocate(memory); }
+
+// Current resident set size of the process in kilobytes (0 if unknown). Not the peak: the peak of the process never goes down,
+// so it would include the containers measured before
+size_t rssKb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize / 1024;
+#else
+	// The second number is the resident pages
+	FILE* statm = std::fopen("/proc/self/statm", "r");
+	if (statm == nullptr) return 0;
+	size_t pages = 0, resident = 0;
+	bool read = std::fscanf(statm, "%zu %zu", &pages, &resident) == 2;
+	std::fclose(statm);
+	return read ? resident * (size_t)sysconf(_SC_PAGESIZE) / 1024 : 0;
+#endif
+}
+
+// Returns the free memory of the heap to the system (where the heap can do it), so the next container doesn't reuse
+// the pages of the previous one without growing the resident memory
+void trimHeap()
+{
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+}
+
+/*==========================================================================================
+
+								  WORKLOADS
+
+===========================================================================================*/
+
+enum OperationKind { Fill, Find, Insert, Erase, KindsCount };
+const char* const KIND_NAMES[KindsCount] = { "fill", "find", "insert", "erase" };
+
+struct Step {
+	OperationKind kind;
+	INT_64 key;
+};
+
+struct Workload {
+	std::string name;
+	size_t n = 0;
+	// Fill steps come first, the measured stream follows
+	std::vector<Step> steps;
+};
+
+// Mirrors test_rand of BST.cpp
+Workload makeRandWorkload(size_t n, std::mt19937_64& random)
+{
+	Workload workload{ "rand", n, {} };
+	std::vector<INT_64> keys(n);
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = random();
+		workload.steps.push_back({ Fill, keys[i] });
+	}
+	for (size_t i = 0; i < n / 2; i++) {
+		if (i % 10 == 0) {
+			workload.steps.push_back({ Erase, random() });
+			workload.steps.push_back({ Insert, keys[random() % n] });
+			workload.steps.push_back({ Find, random() });
+		}
+		else {
+			size_t index = random() % n;
+			workload.steps.push_back({ Erase, keys[index] });
+			keys[index] = random();
+			workload.steps.push_back({ Insert, keys[index] });
+			workload.steps.push_back({ Find, keys[random() % n] });
+		}
+	}
+	return workload;
+}
+
+// Mirrors test_ord of BST.cpp: the keys are even multiples of 10000, the random keys are odd
+Workload makeOrdWorkload(size_t n, std::mt19937_64& random)
+{
+	Workload workload{ "ord", n, {} };
+	for (size_t i = 0; i < n; i++)
+		workload.steps.push_back({ Fill, (INT_64)i * 10000 });
+	auto oddKey = [&]() { return random() % (10000 * n) | 1; };
+	for (size_t i = 0; i < n / 2; i++) {
+		workload.steps.push_back({ Erase, oddKey() });
+		workload.steps.push_back({ Insert, (INT_64)(random() % n) * 10000 });
+		workload.steps.push_back({ Find, oddKey() });
+	}
+	return workload;
+}
+
+// Keys are taken from [0; 2n): about a half of the finds and erases hit
+Workload makeMixedWorkload(size_t n, size_t ops, unsigned findPercent, unsigned insertPercent, std::mt19937_64& random)
+{
+	Workload workload{ "mixed", n, {} };
+	INT_64 range = 2 * (INT_64)n + 1;
+	for (size_t i = 0; i < n; i++)
+		workload.steps.push_back({ Fill, random() % range });
+	for (size_t i = 0; i < ops; i++) {
+		unsigned dice = random() % 100;
+		OperationKind kind = dice < findPercent ? Find : dice < findPercent + insertPercent ? Insert : Erase;
+		workload.steps.push_back({ kind, random() % range });
+	}
+	return workload;
+}
+
+/*==========================================================================================
+
+								  CONTAINERS
+
+===========================================================================================*/
+
+// Uniform interface of the measured containers. Lookups don't throw on a miss: it costs the same as a hit
+template<Balancing B>
+struct TreeContainer {
+	BinaryTree<INT_64, int, B> tree;
+
+	bool insert(INT_64 key) { return tree.insert(key, 1); }
+	bool erase(INT_64 key) { return tree.erase(key); }
+	bool find(INT_64 key) { return tree.try_get(key) != nullptr; }
+	size_t size() const { return tree.size(); }
+};
+
+struct MapContainer {
+	std::map<INT_64, int> map;
+
+	bool insert(INT_64 key) { return map.emplace(key, 1).second; }
+	bool erase(INT_64 key) { return map.erase(key) != 0; }
+	bool find(INT_64 key) { return map.find(key) != map.end(); }
+	size_t size() const { return map.size(); }
+};
+
+// Concurrent containers of the multi-threaded mode: every operation can be called by any thread
+
+// Lock-free readers, writers lock a few nodes
+struct OptimisticContainer {
+	OptimisticBinaryTree<INT_64, int> tree;
+
+	bool insert(INT_64 key) { return tree.insert(key, 1); }
+	bool erase(INT_64 key) { return tree.erase(key); }
+	bool find(INT_64 key) { return tree.contains(key); }
+	size_t size() const { return tree.size(); }
+};
+
+// One reader-writer lock for the whole AVL tree
+struct LockedContainer {
+	ConcurrentBinaryTree<INT_64, int, Balancing::AVL> tree;
+
+	bool insert(INT_64 key) { return tree.insert(key, 1); }
+	bool erase(INT_64 key) { return tree.erase(key); }
+	bool find(INT_64 key) { return tree.contains(key); }
+	size_t size() const { return tree.size(); }
+};
+
+/*==========================================================================================
+
+								  MEASUREMENT
+
+===========================================================================================*/
+
+struct Result {
+	std::string container;
+	OperationKind kind;
+	size_t count = 0;
+	double meanNs = 0;
+	double p50Ns = 0, p90Ns = 0, p99Ns = 0, p999Ns = 0, maxNs = 0;
+	double opsPerSec = 0;
+	double bytesPerElement = 0;
+	// Resident memory added by the filling
+	size_t rssGrowthKb = 0;
+};
+
+// Volatile sink keeps the results of the operations from being optimized out
+volatile size_t sink = 0;
+
+template<typename Container>
+void run(const std::string& name, const Workload& workload, std::vector<Result>& results)
+{
+	typedef std::chrono::steady_clock Clock;
+	std::vector<uint64_t> latencies[KindsCount];
+	for (const Step& step : workload.steps)
+		latencies[step.kind].push_back(0);
+	size_t counts[KindsCount] = {};
+
+	trimHeap();
+	size_t heapBefore = heap::liveBytes;
+	size_t rssBefore = rssKb();
+	double bytesPerElement = 0;
+	size_t rssGrowth = 0;
+	{
+		Container container;
+		auto measureMemory = [&]() {
+			size_t elements = container.size();
+			bytesPerElement = elements == 0 ? 0 : double(heap::liveBytes - heapBefore) / elements;
+			size_t rss = rssKb();
+			rssGrowth = rss > rssBefore ? rss - rssBefore : 0;
+		};
+		size_t done = 0;
+		size_t succeeded = 0;
+		for (const Step& step : workload.steps) {
+			// Memory is measured when the filling finishes
+			if (step.kind != Fill && done == workload.n)
+				measureMemory();
+			Clock::time_point start = Clock::now();
+			switch (step.kind) {
+			case Fill:
+			case Insert: succeeded += container.insert(step.key); break;
+			case Erase: succeeded += container.erase(step.key); break;
+			case Find: succeeded += container.find(step.key); break;
+			default: break;
+			}
+			Clock::time_point finish = Clock::now();
+			latencies[step.kind][counts[step.kind]++] = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+			done++;
+		}
+		sink = succeeded;
+		if (done == workload.n)
+			measureMemory();
+	}
+
+	for (int kind = 0; kind < KindsCount; kind++) {
+		std::vector<uint64_t>& values = latencies[kind];
+		if (values.empty()) continue;
+		std::sort(values.begin(), values.end());
+		auto percentile = [&](double p) { return (double)values[std::min(values.size() - 1, (size_t)(p * values.size()))]; };
+		double total = 0;
+		for (uint64_t value : values) total += (double)value;
+		Result result;
+		result.container = name;
+		result.kind = (OperationKind)kind;
+		result.count = values.size();
+		result.meanNs = total / values.size();
+		result.p50Ns = percentile(0.5);
+		result.p90Ns = percentile(0.9);
+		result.p99Ns = percentile(0.99);
+		result.p999Ns = percentile(0.999);
+		result.maxNs = (double)values.back();
+		result.opsPerSec = total > 0 ? values.size() * 1e9 / total : 0;
+		result.bytesPerElement = bytesPerElement;
+		result.rssGrowthKb = rssGrowth;
+		results.push_back(result);
+	}
+}
+
+/*==========================================================================================
+
+								  THREADS
+
+===========================================================================================*/
+
+// The rand workload for several threads. The filling is the same as in makeRandWorkload, the n/2 rounds (or --ops rounds)
+// are divided between the threads. Every thread owns a slice of the keys array: it erases and replaces only its own keys,
+// so the hits stay hits while the threads run at once
+struct ThreadedWorkload {
+	size_t n = 0;
+	std::vector<INT_64> fill;
+	// Rounds of every thread: erase, insert, find
+	std::vector<std::vector<Step>> threads;
+};
+
+ThreadedWorkload makeThreadedWorkload(size_t n, size_t rounds, unsigned threads, unsigned long long seed)
+{
+	// Every number of threads gets the same filling
+	std::mt19937_64 random(seed);
+	ThreadedWorkload workload{ n, {}, std::vector<std::vector<Step>>(threads) };
+	for (size_t i = 0; i < n; i++)
+		workload.fill.push_back(random());
+	for (unsigned t = 0; t < threads; t++) {
+		std::vector<INT_64> keys(workload.fill.begin() + n * t / threads, workload.fill.begin() + n * (t + 1) / threads);
+		std::vector<Step>& steps = workload.threads[t];
+		for (size_t i = rounds * t / threads; i < rounds * (t + 1) / threads; i++) {
+			if (i % 10 == 0) {
+				steps.push_back({ Erase, random() });
+				steps.push_back({ Insert, keys[random() % keys.size()] });
+				steps.push_back({ Find, random() });
+			}
+			else {
+				size_t index = random() % keys.size();
+				steps.push_back({ Erase, keys[index] });
+				keys[index] = random();
+				steps.push_back({ Insert, keys[index] });
+				steps.push_back({ Find, keys[random() % keys.size()] });
+			}
+		}
+	}
+	return workload;
+}
+
+struct ThroughputResult {
+	std::string container;
+	unsigned threads = 0;
+	size_t operations = 0;
+	double seconds = 0;
+	double opsPerSec = 0;
+	// Against the first run of the container
+	double speedup = 0;
+	// Heap bytes requested by the container / its size
+	double fillBytesPerElement = 0;
+	double bytesPerElement = 0;
+};
+
+// Heap bytes requested since heapBefore per element of the container
+template<typename Container>
+double bytesPerElement(const Container& container, size_t heapBefore)
+{
+	size_t elements = container.size();
+	return elements == 0 ? 0 : double(heap::liveBytes - heapBefore) / elements;
+}
+
+// Fills the rest of the result: the speedup against the first run of the container
+void addThroughput(ThroughputResult result, std::vector<ThroughputResult>& results)
+{
+	result.opsPerSec = result.seconds > 0 ? result.operations / result.seconds : 0;
+	for (const ThroughputResult& previous : results)
+		if (previous.container == result.container) {
+			result.speedup = previous.opsPerSec > 0 ? result.opsPerSec / previous.opsPerSec : 0;
+			break;
+		}
+	if (result.speedup == 0)
+		result.speedup = 1;
+	results.push_back(result);
+}
+
+// Only the rounds are timed: from the moment all the threads are started and released till the last of them finishes
+template<typename Container>
+void runThreaded(const std::string& name, const ThreadedWorkload& workload, std::vector<ThroughputResult>& results)
+{
+	typedef std::chrono::steady_clock Clock;
+	ThroughputResult result;
+	size_t heapBefore = heap::liveBytes;
+	Container container;
+	for (INT_64 key : workload.fill)
+		container.insert(key);
+	result.fillBytesPerElement = bytesPerElement(container, heapBefore);
+
+	std::atomic<bool> started = false;
+	std::atomic<size_t> succeeded = 0;
+	std::vector<std::thread> threads;
+	for (const std::vector<Step>& steps : workload.threads)
+		threads.emplace_back([&] {
+			while (!started.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			size_t done = 0;
+			for (const Step& step : steps) {
+				switch (step.kind) {
+				case Insert: done += container.insert(step.key); break;
+				case Erase: done += container.erase(step.key); break;
+				case Find: done += container.find(step.key); break;
+				default: break;
+				}
+			}
+			succeeded.fetch_add(done, std::memory_order_relaxed);
+		});
+	Clock::time_point start = Clock::now();
+	started.store(true, std::memory_order_release);
+	for (std::thread& thread : threads)
+		thread.join();
+	Clock::time_point finish = Clock::now();
+	sink = succeeded.load();
+	result.bytesPerElement = bytesPerElement(container, heapBefore);
+
+	result.container = name;
+	result.threads = (unsigned)workload.threads.size();
+	for (const std::vector<Step>& steps : workload.threads)
+		result.operations += steps.size();
+	result.seconds = std::chrono::duration<double>(finish - start).count();
+	addThroughput(result, results);
+}
+
+// Memory of the nodes erased while a thread is preempted inside an operation can't be reused until it finishes the operation
+// (up to a window of nodes for every pair), but it must not grow with the number of the rounds
+const double MEMORY_GROWTH_LIMIT = 4;
+
+// Producer/consumer run: every pair of threads has its own keys, the producer inserts them and the consumer erases them
+// in the same order, at most window keys behind (the windows of the pairs make n). The producers fill their windows first,
+// then the rounds (one insert and one erase each) are timed. The container keeps n elements all the time, and the nodes
+// of the producers are freed by the consumers: the memory per element must not grow with the number of the rounds
+template<typename Container>
+void runProducerConsumer(const std::string& name, size_t n, size_t rounds, unsigned threads, unsigned long long seed,
+	std::vector<ThroughputResult>& results)
+{
+	typedef std::chrono::steady_clock Clock;
+	const unsigned pairs = threads / 2;
+	const size_t window = n / pairs;
+	const size_t pairRounds = rounds / pairs;
+	// Multiplication by an odd number is a bijection: the keys of all the pairs are different and not sorted
+	auto key = [&](unsigned pair, size_t index) { return ((INT_64)index * pairs + pair + seed) * 0x9E3779B97F4A7C15ull; };
+	// Keys of the pair passed by its threads. The counters are written by different threads: they don't share a cache line
+	struct Progress {
+		alignas(64) std::atomic<size_t> produced = 0;
+		alignas(64) std::atomic<size_t> consumed = 0;
+	};
+	std::vector<Progress> progress(pairs);
+
+	ThroughputResult result;
+	size_t heapBefore = heap::liveBytes;
+	Container container;
+	std::atomic<unsigned> filled = 0;
+	std::atomic<bool> started = false;
+	std::vector<std::thread> workers;
+	for (unsigned pair = 0; pair < pairs; pair++) {
+		workers.emplace_back([&, pair] {
+			// The producer fills its window itself: the nodes are in the memory of its thread from the start
+			for (size_t i = 0; i < window; i++)
+				container.insert(key(pair, i));
+			progress[pair].produced.store(window, std::memory_order_release);
+			filled.fetch_add(1, std::memory_order_release);
+			while (!started.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			for (size_t i = window; i < window + pairRounds; i++) {
+				while (i - progress[pair].consumed.load(std::memory_order_acquire) >= window)
+					std::this_thread::yield();
+				container.insert(key(pair, i));
+				progress[pair].produced.store(i + 1, std::memory_order_release);
+			}
+		});
+		workers.emplace_back([&, pair] {
+			while (!started.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			for (size_t i = 0; i < pairRounds; i++) {
+				while (progress[pair].produced.load(std::memory_order_acquire) <= i)
+					std::this_thread::yield();
+				container.erase(key(pair, i));
+				progress[pair].consumed.store(i + 1, std::memory_order_release);
+			}
+		});
+	}
+	while (filled.load(std::memory_order_acquire) != pairs)
+		std::this_thread::yield();
+	result.fillBytesPerElement = bytesPerElement(container, heapBefore);
+	Clock::time_point start = Clock::now();
+	started.store(true, std::memory_order_release);
+	for (std::thread& worker : workers)
+		worker.join();
+	Clock::time_point finish = Clock::now();
+	result.bytesPerElement = bytesPerElement(container, heapBefore);
+
+	result.container = name;
+	result.threads = pairs * 2;
+	result.operations = 2 * pairRounds * pairs;
+	result.seconds = std::chrono::duration<double>(finish - start).count();
+	addThroughput(result, results);
+}
+
+/*==========================================================================================
+
+								  OUTPUT
+
+===========================================================================================*/
+
+void printText(const Workload& workload, unsigned long long seed, const std::vector<Result>& results)
+{
+	std::printf("workload %s, n = %zu, seed = %llu\n", workload.name.c_str(), workload.n, seed);
+	std::printf("%-10s %-7s %10s %10s %10s %10s %10s %10s %10s %14s %10s %12s\n",
+		"container", "op", "count", "mean ns", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns", "ops/sec", "B/elem", "RSS +KB");
+	for (const Result& r : results)
+		std::printf("%-10s %-7s %10zu %10.1f %10.0f %10.0f %10.0f %10.0f %10.0f %14.0f %10.1f %12zu\n",
+			r.container.c_str(), KIND_NAMES[r.kind], r.count, r.meanNs, r.p50Ns, r.p90Ns, r.p99Ns, r.p999Ns, r.maxNs, r.opsPerSec, r.bytesPerElement, r.rssGrowthKb);
+}
+
+void printCsv(const Workload& workload, unsigned long long seed, const std::vector<Result>& results)
+{
+	std::printf("workload,n,seed,container,op,count,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,ops_per_sec,bytes_per_element,rss_growth_kb\n");
+	for (const Result& r : results)
+		std::printf("%s,%zu,%llu,%s,%s,%zu,%.1f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.1f,%zu\n",
+			workload.name.c_str(), workload.n, seed, r.container.c_str(), KIND_NAMES[r.kind], r.count, r.meanNs, r.p50Ns, r.p90Ns, r.p99Ns, r.p999Ns, r.maxNs, r.opsPerSec, r.bytesPerElement, r.rssGrowthKb);
+}
+
+void printJson(const Workload& workload, unsigned long long seed, const std::vector<Result>& results)
+{
+	std::printf("{\n  \"workload\": \"%s\",\n  \"n\": %zu,\n  \"seed\": %llu,\n  \"results\": [\n", workload.name.c_str(), workload.n, seed);
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		std::printf("    {\"container\": \"%s\", \"op\": \"%s\", \"count\": %zu, \"mean_ns\": %.1f, \"p50_ns\": %.0f, \"p90_ns\": %.0f, "
+			"\"p99_ns\": %.0f, \"p999_ns\": %.0f, \"max_ns\": %.0f, \"ops_per_sec\": %.0f, \"bytes_per_element\": %.1f, \"rss_growth_kb\": %zu}%s\n",
+			r.container.c_str(), KIND_NAMES[r.kind], r.count, r.meanNs, r.p50Ns, r.p90Ns, r.p99Ns, r.p999Ns, r.maxNs, r.opsPerSec, r.bytesPerElement, r.rssGrowthKb,
+			i + 1 < results.size() ? "," : "");
+	}
+	std::printf("  ]\n}\n");
+}
+
+void printThroughputText(const std::string& workload, size_t n, unsigned long long seed, const std::vector<ThroughputResult>& results)
+{
+	std::printf("workload %s, n = %zu, seed = %llu\n", workload.c_str(), n, seed);
+	std::printf("%-10s %8s %12s %10s %14s %8s %12s %12s\n", "container", "threads", "operations", "seconds", "ops/sec", "speedup", "fill B/elem", "end B/elem");
+	for (const ThroughputResult& r : results)
+		std::printf("%-10s %8u %12zu %10.3f %14.0f %8.2f %12.1f %12.1f\n",
+			r.container.c_str(), r.threads, r.operations, r.seconds, r.opsPerSec, r.speedup, r.fillBytesPerElement, r.bytesPerElement);
+}
+
+void printThroughputCsv(const std::string& workload, size_t n, unsigned long long seed, const std::vector<ThroughputResult>& results)
+{
+	std::printf("workload,n,seed,container,threads,operations,seconds,ops_per_sec,speedup,fill_bytes_per_element,bytes_per_element\n");
+	for (const ThroughputResult& r : results)
+		std::printf("%s,%zu,%llu,%s,%u,%zu,%.3f,%.0f,%.2f,%.1f,%.1f\n", workload.c_str(), n, seed, r.container.c_str(), r.threads, r.operations,
+			r.seconds, r.opsPerSec, r.speedup, r.fillBytesPerElement, r.bytesPerElement);
+}
+
+void printThroughputJson(const std::string& workload, size_t n, unsigned long long seed, const std::vector<ThroughputResult>& results)
+{
+	std::printf("{\n  \"workload\": \"%s\",\n  \"n\": %zu,\n  \"seed\": %llu,\n  \"results\": [\n", workload.c_str(), n, seed);
+	for (size_t i = 0; i < results.size(); i++) {
+		const ThroughputResult& r = results[i];
+		std::printf("    {\"container\": \"%s\", \"threads\": %u, \"operations\": %zu, \"seconds\": %.3f, \"ops_per_sec\": %.0f, \"speedup\": %.2f, "
+			"\"fill_bytes_per_element\": %.1f, \"bytes_per_element\": %.1f}%s\n",
+			r.container.c_str(), r.threads, r.operations, r.seconds, r.opsPerSec, r.speedup, r.fillBytesPerElement, r.bytesPerElement,
+			i + 1 < results.size() ? "," : "");
+	}
+	std::printf("  ]\n}\n");
+}
+
+/*==========================================================================================
+
+								  MAIN
+
+===========================================================================================*/
+
+int usage(const char* program)
+{
+	std::fprintf(stderr, "usage: %s [--workload rand|ord|mixed] [--n N] [--ops M] [--seed S] [--find P] [--insert P] [--erase P]\n"
+		"       [--containers none,avl,rb,map] [--format text|csv|json]\n"
+		"       %s --threads 1,2,4,8,16 [--workload rand|prodcons] [--n N] [--ops M] [--seed S] [--containers olc,locked]\n"
+		"       [--format text|csv|json]\n", program, program);
+	return 2;
+}
+
+// Items of the comma-separated list
+std::vector<std::string> splitList(const std::string& list)
+{
+	std::vector<std::string> items;
+	size_t position = 0;
+	while (position <= list.size()) {
+		size_t comma = list.find(',', position);
+		if (comma == std::string::npos) comma = list.size();
+		items.push_back(list.substr(position, comma - position));
+		position = comma + 1;
+	}
+	return items;
+}
+
+// --threads mode: --ops is the number of the rounds (3 operations each for rand, 2 for prodcons)
+int runThreadedMode(const std::string& workloadName, const std::string& threadsList, std::string containers, size_t n, size_t rounds,
+	unsigned long long seed, const std::string& format, const char* program)
+{
+	if (containers.empty()) containers = "olc,locked";
+	bool producerConsumer = workloadName == "prodcons";
+	std::vector<unsigned> threadCounts;
+	try {
+		for (const std::string& item : splitList(threadsList)) {
+			unsigned long count = std::stoul(item);
+			if (count == 0 || count > n) {
+				std::fprintf(stderr, "--threads must be in [1; n]\n");
+				return 2;
+			}
+			if (producerConsumer && count % 2 != 0) {
+				std::fprintf(stderr, "--threads of prodcons must be even: the threads work in pairs\n");
+				return 2;
+			}
+			threadCounts.push_back((unsigned)count);
+		}
+	}
+	catch (const std::exception&) {
+		return usage(program);
+	}
+
+	std::vector<ThroughputResult> results;
+	for (const std::string& name : splitList(containers)) {
+		if (name != "olc" && name != "locked") return usage(program);
+		for (unsigned threads : threadCounts) {
+			if (producerConsumer) {
+				if (name == "olc") runProducerConsumer<OptimisticContainer>("olc", n, rounds, threads, seed, results);
+				else runProducerConsumer<LockedContainer>("locked", n, rounds, threads, seed, results);
+				continue;
+			}
+			ThreadedWorkload workload = makeThreadedWorkload(n, rounds, threads, seed);
+			if (name == "olc") runThreaded<OptimisticContainer>("olc", workload, results);
+			else runThreaded<LockedContainer>("locked", workload, results);
+		}
+	}
+
+	if (format == "csv") printThroughputCsv(workloadName, n, seed, results);
+	else if (format == "json") printThroughputJson(workloadName, n, seed, results);
+	else printThroughputText(workloadName, n, seed, results);
+
+	// The erased nodes must be reused: otherwise the memory grows with the rounds, not with the elements
+	int status = 0;
+	for (const ThroughputResult& r : results)
+		if (producerConsumer && r.bytesPerElement > MEMORY_GROWTH_LIMIT * r.fillBytesPerElement) {
+			std::fprintf(stderr, "%s, %u threads: the memory per element grew from %.1f to %.1f bytes\n",
+				r.container.c_str(), r.threads, r.fillBytesPerElement, r.bytesPerElement);
+			status = 1;
+		}
+	return status;
+}
+
+int main(int argc, char** argv)
+{
+	std::string workloadName = "rand";
+	std::string containers;
+	std::string format = "text";
+	std::string threadsList;
+	size_t n = 100000;
+	size_t ops = 0;
+	unsigned long long seed = 15750;
+	unsigned findPercent = 80, insertPercent = 10, erasePercent = 10;
+
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= argc) return usage(argv[0]);
+		std::string value = argv[++i];
+		try {
+			if (option == "--workload") workloadName = value;
+			else if (option == "--n") n = std::stoull(value);
+			else if (option == "--ops") ops = std::stoull(value);
+			else if (option == "--seed") seed = std::stoull(value);
+			else if (option == "--find") findPercent = std::stoul(value);
+			else if (option == "--insert") insertPercent = std::stoul(value);
+			else if (option == "--erase") erasePercent = std::stoul(value);
+			else if (option == "--containers") containers = value;
+			else if (option == "--format") format = value;
+			else if (option == "--threads") threadsList = value;
+			else return usage(argv[0]);
+		}
+		catch (const std::exception&) {
+			return usage(argv[0]);
+		}
+	}
+	if (!threadsList.empty()) {
+		// prodcons passes every key of the windows through the container 8 times by default
+		if (workloadName == "rand") return runThreadedMode(workloadName, threadsList, containers, n, ops != 0 ? ops : n / 2, seed, format, argv[0]);
+		if (workloadName == "prodcons") return runThreadedMode(workloadName, threadsList, containers, n, ops != 0 ? ops : 8 * n, seed, format, argv[0]);
+		return usage(argv[0]);
+	}
+	if (containers.empty()) containers = "none,avl,rb,map";
+	if (findPercent + insertPercent + erasePercent != 100) {
+		std::fprintf(stderr, "--find, --insert and --erase must sum up to 100\n");
+		return 2;
+	}
+
+	std::mt19937_64 random(seed);
+	Workload workload;
+	if (workloadName == "rand") workload = makeRandWorkload(n, random);
+	else if (workloadName == "ord") workload = makeOrdWorkload(n, random);
+	else if (workloadName == "mixed") workload = makeMixedWorkload(n, ops != 0 ? ops : n, findPercent, insertPercent, random);
+	else return usage(argv[0]);
+
+	std::vector<Result> results;
+	for (const std::string& name : splitList(containers)) {
+		if (name == "none") run<TreeContainer<Balancing::None>>("bst", workload, results);
+		else if (name == "avl") run<TreeContainer<Balancing::AVL>>("avl", workload, results);
+		else if (name == "rb") run<TreeContainer<Balancing::RedBlack>>("redblack", workload, results);
+		else if (name == "map") run<MapContainer>("std::map", workload, results);
+		else return usage(argv[0]);
+	}
+
+	if (format == "csv") printCsv(workload, seed, results);
+	else if (format == "json") printJson(workload, seed, results);
+	else printText(workload, seed, results);
+	return 0;
+}